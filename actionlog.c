@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "actionlog.h"
+#include "helpers.h"
+
+/* create an action log to write */
+ActionLog *newActionLog(const char *file, ActionLogHeader *hdr)
+{
+    ActionLog *ret;
+    size_t tmpz;
+
+    SF(ret, malloc, NULL, (sizeof(ActionLog)));
+    ret->hdr = *hdr;
+    memcpy(ret->hdr.magic, ACTIONLOG_MAGIC, sizeof(ret->hdr.magic));
+    ret->hdr.version = ACTIONLOG_VERSION;
+    ret->hdr.hdrSz = sizeof(ActionLogHeader);
+
+    SF(ret->fh, fopen, NULL, (file, "wb"));
+    SF(tmpz, fwrite, 0, (&ret->hdr, sizeof(ActionLogHeader), 1, ret->fh));
+    return ret;
+}
+
+/* open an action log to read */
+ActionLog *openActionLog(const char *file)
+{
+    ActionLog *ret;
+
+    SF(ret, malloc, NULL, (sizeof(ActionLog)));
+    SF(ret->fh, fopen, NULL, (file, "rb"));
+    if (fread(&ret->hdr, sizeof(ActionLogHeader), 1, ret->fh) != 1 ||
+        memcmp(ret->hdr.magic, ACTIONLOG_MAGIC, sizeof(ret->hdr.magic)) ||
+        ret->hdr.version != ACTIONLOG_VERSION || ret->hdr.hdrSz != sizeof(ActionLogHeader)) {
+        fprintf(stderr, "%s is not an action log from this version of rezzo on this machine.\n", file);
+        exit(1);
+    }
+    ret->hdr.resume[sizeof(ret->hdr.resume) - 1] = 0;
+    return ret;
+}
+
+/* record an action by the agent with this id */
+void logAction(ActionLog *log, unsigned char id, unsigned char act)
+{
+    putc(id, log->fh);
+    putc(act, log->fh);
+}
+
+/* record a tick of the world. Matches don't end, so this is the only flush */
+void logTick(ActionLog *log)
+{
+    int tmpi;
+    logAction(log, LOG_TICK, 0);
+    SF(tmpi, fflush, EOF, (log->fh));
+}
+
+/* read the next record of an action log */
+int readAction(ActionLog *log, unsigned char *id, unsigned char *act)
+{
+    int i, a;
+    if ((i = getc(log->fh)) == EOF || (a = getc(log->fh)) == EOF) return 0;
+    *id = i;
+    *act = a;
+    return 1;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef ACTIONLOG_H
+#define ACTIONLOG_H
+
+#include <stdio.h>
+
+#define ACTIONLOG_MAGIC "REZZOLOG"
+#define ACTIONLOG_VERSION 2
+
+typedef struct _ActionLogHeader ActionLogHeader;
+typedef struct _ActionLog ActionLog;
+
+/* an action log is this header, in the byte order and sizes of the machine
+ * which wrote it, then pairs of bytes: an agent id and an action of it
+ * which was accepted (or LOG_DIED), or LOG_TICK and 0 when the world ticked.
+ * Agents are only created before the first tick, so replaying it with the
+ * same seed gives the same match */
+struct _ActionLogHeader {
+    char magic[8];
+    unsigned int version, hdrSz;
+    int seed, w, h, warm, nagents;
+    int blank; /* the world started blank, rather than random */
+    char resume[256]; /* snapshot the match was resumed from, if any */
+};
+
+struct _ActionLog {
+    FILE *fh;
+    ActionLogHeader hdr;
+};
+
+enum ActionLogRecords {
+    LOG_TICK = 0, /* in place of an id */
+    LOG_DIED = 0 /* in place of an action: the agent died, but not of a loss */
+};
+
+/* create an action log to write */
+ActionLog *newActionLog(const char *file, ActionLogHeader *hdr);
+
+/* open an action log to read, checking its header */
+ActionLog *openActionLog(const char *file);
+
+/* record an action by the agent with this id */
+void logAction(ActionLog *log, unsigned char id, unsigned char act);
+
+/* record a tick of the world, which also flushes the log */
+void logTick(ActionLog *log);
+
+/* read the next record of an action log, returning 0 at the end */
+int readAction(ActionLog *log, unsigned char *id, unsigned char *act);
+
+#endif
@@ -24,6 +24,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "actionlog.h"
 #include "agent.h"
 
 /* create an agent list */
@@ -38,15 +39,24 @@ AgentList *newAgentList(World *world)
 
 /* generate a new client */
 Agent *newAgent(AgentList *list, pid_t pid, int rfd, int wfd)
+{
+    return newAgentAt(list, pid, rfd, wfd, NULL);
+}
+
+/* generate a new client in the place of one which is already in the world */
+Agent *newAgentAt(AgentList *list, pid_t pid, int rfd, int wfd, AgentPlace *place)
 {
     World *world = list->world;
     Agent *ret;
-    int i, posok, x, y;
+    int x, y;
+    size_t i;
     CardinalityHelper ch;
 
     SF(ret, malloc, NULL, (sizeof(Agent)));
     memset(ret, 0, sizeof(Agent));
     ret->alive = 1;
+    ret->protocol = 1;
+    ret->list = list;
     ret->world = list->world;
     ret->pid = pid;
     ret->rfd = rfd;
@@ -64,25 +74,27 @@ Agent *newAgent(AgentList *list, pid_t pid, int rfd, int wfd)
         list->tail = ret;
     }
 
-    /* put it somewhere random */
-    posok = 0;
-    while (!posok) {
-        ret->x = random() % world->w;
-        ret->y = random() % world->h;
-        i = getCell(world, ret->x, ret->y);
-
-        /* check the surrounding area */
-        posok = 1;
-        for (y = -2; y <= 2; y++) {
-            for (x = -2; x <= 2; x++) {
-                if (world->owner[getCell(world, ret->x + x, ret->y + y)]) {
-                    posok = 0;
-                    goto posnotok;
-                }
-            }
-        }
-        posnotok: (void) 0;
+#ifdef REZZO_STATS
+    if (pid > 0) {
+        char name[64];
+        sprintf(name, "agent %d (pid %d)", (int) ret->id, (int) pid);
+        ret->latency = newStatHistogram(name);
+    }
+#endif
+
+    if (place) {
+        /* its agent, base and geysers are already there */
+        ret->x = place->x;
+        ret->y = place->y;
+        ret->c = place->c;
+        ret->startx = place->startx;
+        ret->starty = place->starty;
+        return ret;
     }
+
+    /* put it somewhere random */
+    freeSpot(world, 2, &ret->x, &ret->y);
+    i = getCell(world, ret->x, ret->y);
     ret->startx = ret->x;
     ret->starty = ret->y;
 
@@ -90,39 +102,91 @@ Agent *newAgent(AgentList *list, pid_t pid, int rfd, int wfd)
     for (y = -2; y <= 2; y++) {
         for (x = -2; x <= 2; x++) {
             world->c[getCell(world, ret->x + x, ret->y + y)] = CELL_NONE;
+            touchCell(world, ret->x + x, ret->y + y);
         }
     }
     ret->c = random() % CARDINALITIES;
     ch = cardinalityHelpers[ret->c];
 
     world->c[i] = CELL_AGENT;
-    world->owner[i] = ret->id;
+    setOwner(world, i, ret->id);
 
     /* base cells */
     i = getCell(world,
         ret->x + ch.xr*-1 + ch.xd*-1,
         ret->y + ch.yr*-1 + ch.yd*-1);
     world->c[i] = CELL_BASE;
-    world->owner[i] = ret->id;
+    setOwner(world, i, ret->id);
     i = getCell(world,
         ret->x + ch.xr*1 + ch.xd*-1,
         ret->y + ch.yr*1 + ch.yd*-1);
     world->c[i] = CELL_BASE;
-    world->owner[i] = ret->id;
+    setOwner(world, i, ret->id);
     i = getCell(world,
         ret->x + ch.xr*-1 + ch.xd*1,
         ret->y + ch.yr*-1 + ch.yd*1);
     world->c[i] = CELL_FLAG_GEYSER;
-    world->owner[i] = ret->id;
+    setOwner(world, i, ret->id);
     i = getCell(world,
         ret->x + ch.xr*1 + ch.xd*1,
         ret->y + ch.yr*1 + ch.yd*1);
     world->c[i] = CELL_FLAG_GEYSER;
-    world->owner[i] = ret->id;
+    setOwner(world, i, ret->id);
 
     return ret;
 }
 
+/* encode cur as runs of a skip count, a literal count, and that many
+ * literals XORed with base. Returns the length, or -1 if it's no smaller
+ * than cur itself */
+static int encodeDelta(unsigned char *out, unsigned char *cur, unsigned char *base, int sz)
+{
+    int i = 0, o = 0, skip, n;
+
+    while (i < sz) {
+        for (skip = 0; i < sz && skip < 255 && cur[i] == base[i]; skip++, i++);
+        for (n = 0; i + n < sz && n < 255 && cur[i+n] != base[i+n]; n++);
+        if (n == 0 && i == sz) break;
+        if (o + 2 + n >= sz) return -1;
+        out[o++] = skip;
+        out[o++] = n;
+        for (; n > 0; n--, i++) out[o++] = cur[i] ^ base[i];
+    }
+
+    return o;
+}
+
+/* buffer a server message in protocol 2 */
+static void agentServerMessage2(Agent *agent, ServerMessage *sm)
+{
+    ServerMessage2 hdr;
+    unsigned char delta[2*VIEWPORT_SQ];
+    int len = -1;
+
+    memcpy(agent->view, sm->c, VIEWPORT_SQ);
+    memcpy(agent->view + VIEWPORT_SQ, sm->damage, VIEWPORT_SQ);
+    agent->hasView = 1;
+    hdr.ack = sm->ack;
+    hdr.ts = sm->ts;
+
+    if (agent->hasAck)
+        len = encodeDelta(delta, agent->view, agent->ackView, 2*VIEWPORT_SQ);
+
+    if (len >= 0) {
+        hdr.kind = MSG_DELTA;
+        hdr.base = agent->ackTs;
+        hdr.len = len;
+        WRITE_BUFFER(agent->wbuf, &hdr, sizeof(ServerMessage2));
+        WRITE_BUFFER(agent->wbuf, delta, len);
+    } else {
+        hdr.kind = MSG_KEYFRAME;
+        hdr.base = 0;
+        hdr.len = 2*VIEWPORT_SQ;
+        WRITE_BUFFER(agent->wbuf, &hdr, sizeof(ServerMessage2));
+        WRITE_BUFFER(agent->wbuf, agent->view, 2*VIEWPORT_SQ);
+    }
+}
+
 /* generate a server message for this agent and buffer it */
 void agentServerMessage(Agent *agent)
 {
@@ -137,10 +201,23 @@ void agentServerMessage(Agent *agent)
     /* then the viewport */
     viewport(tosend.c, tosend.damage, agent->world, agent->x, agent->y, agent->c, VIEWPORT);
 
+    if (agent->protocol == 2) {
+        agentServerMessage2(agent, &tosend);
+        return;
+    }
+
     /* now add it to the queue */
     WRITE_BUFFER(agent->wbuf, &tosend, sizeof(ServerMessage));
 }
 
+/* generate and buffer server messages for every agent */
+void agentServerMessages(AgentList *agents)
+{
+    Agent *agent;
+    for (agent = agents->head; agent; agent = agent->next)
+        agentServerMessage(agent);
+}
+
 static void agentClientMessage(Agent *agent, ClientMessage *cm);
 
 /* handle incoming data from this agent */
@@ -169,13 +246,35 @@ static void agentClientMessage(Agent *agent, ClientMessage *cm)
 {
     World *world = agent->world;
     unsigned char ack;
-    int fx, fy, x, y, nx, ny, i, ni;
+    int fx, fy, x, y, nx, ny;
+    size_t i, ni;
+
+    if (cm->act == ACT_PROTOCOL_2) {
+        /* the next message will be a keyframe */
+        agent->protocol = 2;
+        agent->hasView = agent->hasAck = 0;
+        return;
+    }
 
     if (cm->ts != agent->ts) {
         /* this isn't what I was expecting! */
         return;
     }
 
+#ifdef REZZO_STATS
+    if (agent->sentAt) {
+        histAdd(agent->latency, statNow() - agent->sentAt);
+        agent->sentAt = 0;
+    }
+#endif
+
+    if (agent->hasView) {
+        /* they've seen this viewport, so we can send deltas against it */
+        memcpy(agent->ackView, agent->view, 2*VIEWPORT_SQ);
+        agent->ackTs = agent->ts;
+        agent->hasAck = 1;
+    }
+
     if (agent->ack != ACK_NO_MESSAGE) {
         /* hey now, no repeats! */
         agent->ack = ACK_MULTIPLE_MESSAGES;
@@ -212,12 +311,8 @@ static void agentClientMessage(Agent *agent, ClientMessage *cm)
     x = agent->x;
     y = agent->y;
     i = getCell(world, x, y);
-    nx = agent->x + fx;
-    ny = agent->y + fy;
-    if (nx < 0) nx += world->w;
-    if (nx >= world->w) nx -= world->w;
-    if (ny < 0) ny += world->h;
-    if (ny >= world->h) ny -= world->h;
+    nx = WRAP_X(world, agent->x + fx);
+    ny = WRAP_Y(world, agent->y + fy);
     ni = getCell(world, nx, ny);
 
     /* then perform the action */
@@ -232,11 +327,13 @@ static void agentClientMessage(Agent *agent, ClientMessage *cm)
                 agent->x = nx;
                 agent->y = ny;
                 world->c[ni] = CELL_AGENT;
-                world->owner[ni] = agent->id;
-                world->damage[ni] = 0;
+                setOwner(world, ni, agent->id);
+                setDamage(world, ni, 0);
                 world->c[i] = CELL_NONE;
-                world->owner[i] = 0;
-                world->damage[i] = 0;
+                setOwner(world, i, 0);
+                setDamage(world, i, 0);
+                touchCell(world, x, y);
+                touchCell(world, nx, ny);
             } else {
                 ack = ACK_INVALID_ACTION;
             }
@@ -257,11 +354,13 @@ static void agentClientMessage(Agent *agent, ClientMessage *cm)
                 agent->x = nx;
                 agent->y = ny;
                 world->c[ni] = CELL_AGENT;
-                world->owner[ni] = agent->id;
-                world->damage[ni] = 0;
+                setOwner(world, ni, agent->id);
+                setDamage(world, ni, 0);
                 world->c[i] = CELL_CONDUCTOR;
-                world->owner[i] = 0;
-                world->damage[i] = 0;
+                setOwner(world, i, 0);
+                setDamage(world, i, 0);
+                touchCell(world, x, y);
+                touchCell(world, nx, ny);
             } else {
                 ack = ACK_INVALID_ACTION;
             }
@@ -272,11 +371,13 @@ static void agentClientMessage(Agent *agent, ClientMessage *cm)
                 world->c[ni] == CELL_FLAG_GEYSER || world->c[ni] == CELL_BASE) {
                 ack = ACK_INVALID_ACTION;
             } else {
-                world->damage[ni]++;
-                if (world->damage[ni] >= CELL_DESTROY_DAMAGE) {
+                setDamage(world, ni, cellDamage(world, ni) + 1);
+                if (cellDamage(world, ni) >= CELL_DESTROY_DAMAGE) {
                     /* DESTROY! EXTERMINATE! */
+                    if (world->events) worldEvent(world, EVENT_DESTROYED, ni, agent->id);
                     world->c[ni] = CELL_NONE;
-                    world->damage[ni] = 0;
+                    setDamage(world, ni, 0);
+                    touchCell(world, nx, ny);
                 }
             }
             break;
@@ -285,35 +386,56 @@ static void agentClientMessage(Agent *agent, ClientMessage *cm)
             ack = ACK_INVALID_MESSAGE;
     }
     agent->ack = ack;
+
+    /* anything else left the world as it was, so isn't worth logging */
+    if (ack == ACK_OK && agent->list->log) logAction(agent->list->log, agent->id, cm->act);
+}
+
+/* perform a logged action, as if this agent had just sent it in time */
+void agentReplay(Agent *agent, unsigned char act)
+{
+    ClientMessage cm;
+    agent->ts = cm.ts = agent->world->ts;
+    agent->ack = ACK_NO_MESSAGE;
+    cm.act = act;
+    agentClientMessage(agent, &cm);
 }
 
 /* time for this agent to DIE! Muahahahaha */
 void agentDie(Agent *agent)
 {
-    int i;
-    World *world = agent->world;
-    int wh = world->w * world->h;
-
-    /* mark them dead */
+    /* mark them dead, which a replay can't know unless it was a loss */
+    if (agent->alive && agent->list->log) logAction(agent->list->log, agent->id, LOG_DIED);
     agent->alive = 0;
 
     /* close the fds */
     close(agent->rfd);
     if (agent->wfd != agent->rfd) close(agent->wfd);
 
-    /* kill the proc */
-    kill(agent->pid, SIGKILL);
+    /* kill the proc, if there is one (there isn't in replays) */
+    if (agent->pid > 0) kill(agent->pid, SIGKILL);
 
     /* then remove them from the world */
-    for (i = 0; i < wh; i++) {
-        if (world->owner[i] == agent->id) {
-            world->owner[i] = 0;
-            if (world->c[i] == CELL_FLAG) {
-                world->c[i] = CELL_CONDUCTOR;
-            } else {
-                world->c[i] = CELL_NONE;
-            }
+    agentClear(agent->world, agent->id);
+}
+
+/* remove everything owned by this agent from the world */
+void agentClear(World *world, unsigned char id)
+{
+    struct Buffer_size *owned;
+    size_t i;
+    size_t oi;
+
+    owned = ownedCells(world, id);
+    for (oi = 0; oi < owned->bufused; oi++) {
+        i = owned->buf[oi];
+        if (world->c[i] == CELL_FLAG) {
+            world->c[i] = CELL_CONDUCTOR;
+        } else {
+            world->c[i] = CELL_NONE;
         }
+        setOwner(world, i, 0);
+        touchCell(world, cellX(world, i), cellY(world, i));
     }
 }
 
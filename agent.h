@@ -23,6 +23,7 @@
 
 #include "buffer.h"
 #include "ca.h"
+#include "stats.h"
 
 #define VIEWPORT (13)
 #define VIEWPORT_SQ (VIEWPORT*VIEWPORT)
@@ -32,7 +33,9 @@
 typedef struct _Agent Agent;
 typedef struct _AgentList AgentList;
 typedef struct _ServerMessage ServerMessage;
+typedef struct _ServerMessage2 ServerMessage2;
 typedef struct _ClientMessage ClientMessage;
+typedef struct _AgentPlace AgentPlace;
 
 enum ClientAcks {
     ACK_OK = 0,
@@ -48,11 +51,18 @@ enum ClientActions {
     ACT_TURN_LEFT = '\\',
     ACT_TURN_RIGHT = '/',
     ACT_BUILD = '.',
-    ACT_HIT = '!'
+    ACT_HIT = '!',
+    ACT_PROTOCOL_2 = '2' /* switch to protocol 2, which isn't a turn */
+};
+
+enum ServerMessageKinds {
+    MSG_KEYFRAME = 'K',
+    MSG_DELTA = 'D'
 };
 
 struct _Agent {
     Agent *next; /* agents form a list */
+    AgentList *list; /* the list it's in */
     unsigned char id; /* agent number */
     unsigned char alive; /* still alive? */
     World *world; /* the world this agent is in */
@@ -60,14 +70,28 @@ struct _Agent {
     int startx, starty; /* starting location */
     unsigned char ts, ack; /* last turn sent to this client, and ack for its response (if any) */
 
+    /* protocol 2 sends viewports as deltas against the last one the client
+     * responded to, so remember that and the last one sent (c then damage) */
+    unsigned char protocol;
+    unsigned char view[2*VIEWPORT_SQ], ackView[2*VIEWPORT_SQ];
+    unsigned char ackTs, hasView, hasAck;
+
     pid_t pid; /* pid of this process */
     int rfd, wfd; /* FDs to read from and write to this agent */
     struct Buffer_char rbuf, wbuf; /* buffers for things to read/write */
+
+#ifdef REZZO_STATS
+    /* when the last message was written out, if it hasn't been answered,
+     * and how long answers take */
+    unsigned long sentAt;
+    Histogram *latency;
+#endif
 };
 
 struct _AgentList {
     Agent *head, *tail;
     World *world;
+    struct _ActionLog *log; /* where to record what the agents do, or NULL */
 };
 
 struct _ServerMessage {
@@ -76,25 +100,52 @@ struct _ServerMessage {
     unsigned char damage[VIEWPORT_SQ]; /* damage in that area */
 };
 
+/* in protocol 2, followed by len bytes: c and damage for a keyframe, or a
+ * delta against the viewport of ts base */
+struct _ServerMessage2 {
+    unsigned char ack, ts, kind, base;
+    unsigned short len;
+};
+
 struct _ClientMessage {
     unsigned char ts, act; /* for the moment, the action is only one byte */
 };
 
+/* where an agent is, so that another can take its place */
+struct _AgentPlace {
+    unsigned char id, alive;
+    int x, y, c;
+    int startx, starty;
+};
+
 /* create an agent list */
 AgentList *newAgentList(World *world);
 
 /* generate a new client */
 Agent *newAgent(AgentList *list, pid_t pid, int rfd, int wfd);
 
+/* generate a new client in the place of one which is already in the world,
+ * or somewhere random if place is NULL */
+Agent *newAgentAt(AgentList *list, pid_t pid, int rfd, int wfd, AgentPlace *place);
+
 /* generate a server message for this agent and buffer it */
 void agentServerMessage(Agent *agent);
 
+/* generate and buffer server messages for every agent */
+void agentServerMessages(AgentList *agents);
+
 /* handle incoming data from this agent */
 void agentIncoming(Agent *agent);
 
+/* perform a logged action, as if this agent had just sent it in time */
+void agentReplay(Agent *agent, unsigned char act);
+
 /* time for this agent to DIE! Muahahahaha */
 void agentDie(Agent *agent);
 
+/* remove everything owned by this agent from the world */
+void agentClear(World *world, unsigned char id);
+
 /* process the losses in the world */
 void agentProcessLosses(AgentList *agents);
 
@@ -0,0 +1,378 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#define _BSD_SOURCE /* for random */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#include <pthread.h>
+
+#include "agent.h"
+#include "ca.h"
+#include "helpers.h"
+#include "pool.h"
+#include "ui.h"
+
+/* every scenario is run from this seed */
+#define BENCH_SEED 12345
+
+/* and for at least this many ticks and seconds */
+#define BENCH_MIN_TICKS 4
+#define BENCH_MIN_SECS 1.0
+
+/* a frame is drawn and written every this many ticks */
+#define BENCH_FRAME_INTERVAL 16
+
+enum BenchMaps {
+    MAP_EMPTY, MAP_RANDOM, MAP_DENSE, MAP_LOOPS, MAPS
+};
+
+static const char *mapNames[] = {"empty", "random", "dense", "loops"};
+static const int sizes[] = {320, 2048, 8192};
+static const int agentCounts[] = {0, 10, 100};
+
+/* the phases of a tick we time */
+enum BenchPhases {
+    PHASE_UPDATE, PHASE_LOSSES, PHASE_VIEWPORT, PHASE_DRAW, PHASE_PNG, PHASES
+};
+
+static const char *phaseNames[] = {"update", "losses", "viewport", "draw", "png"};
+
+typedef struct _BenchResult BenchResult;
+struct _BenchResult {
+    int map, size, agents;
+    int kernelW; /* the width the kernels were compiled for, or 0 */
+    int blocked; /* the world is laid out in blocks, not rows */
+    unsigned long ticks, frames;
+    long long misses; /* cache misses while updating, or -1 if not counted */
+    double secs;
+    double phases[PHASES]; /* total seconds in each */
+};
+
+static char help_text[] =
+    "Usage: rezzo-bench [options]\n"
+    "Options:\n"
+    "\t-m <map>     Only run this map (empty, random, dense or loops)\n"
+    "\t-s N         Only run this size\n"
+    "\t-a N         Only run with this many agents\n"
+    "\t-j N         Update the world with N threads\n"
+    "\t-T N         Run each scenario for at least N seconds\n"
+    "\t-G           Use the generic kernels, even for power-of-two sizes\n"
+    "\t-B           Lay worlds out in 64x64 blocks rather than rows\n"
+    "\t-J           Report as JSON instead of CSV\n"
+    "Phase times are in ns per tick, except draw and png, which are per frame.\n"
+    "The kernel is the width the kernels were compiled for (64 for blocks),\n"
+    "or 0 if generic.\n"
+    "Cache misses are per cell per tick of the update phase, or -1 if they\n"
+    "can't be counted (with no hardware counters, as in many VMs, or with -j).\n";
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* a little random generator of our own, so the scenarios don't depend on
+ * how much anything else uses random() */
+static unsigned long benchRandom(unsigned long *state)
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return *state >> 33;
+}
+
+/* a rectangular loop of wire with one electron going around it */
+static void ring(World *world, int x, int y, int w, int h)
+{
+    int i;
+    for (i = 0; i < w; i++) {
+        world->c[getCell(world, x + i, y)] = CELL_CONDUCTOR;
+        world->c[getCell(world, x + i, y + h - 1)] = CELL_CONDUCTOR;
+    }
+    for (i = 0; i < h; i++) {
+        world->c[getCell(world, x, y + i)] = CELL_CONDUCTOR;
+        world->c[getCell(world, x + w - 1, y + i)] = CELL_CONDUCTOR;
+    }
+    world->c[getCell(world, x + 1, y)] = CELL_ELECTRON;
+    world->c[getCell(world, x, y)] = CELL_ELECTRON_TAIL;
+}
+
+/* open a counter of this thread's cache misses, disabled, or return -1 */
+static int openMissCounter()
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+    return -1;
+#endif
+}
+
+/* count misses on the counter (if any) only while on is set */
+static void countMisses(int fd, int on)
+{
+#ifdef __linux__
+    if (fd >= 0) ioctl(fd, on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+/* make the world for a scenario */
+static World *benchWorld(int map, int size, int j, int generic, int blocked)
+{
+    World *world = newWorld(size, size, blocked);
+    unsigned long r = BENCH_SEED;
+    int x, y;
+
+    if (j > 1) world->pool = newPool(j);
+    if (generic) worldKernels(world, 0);
+
+    switch (map) {
+        case MAP_RANDOM:
+            randWorld(world, BENCH_SEED);
+            break;
+
+        case MAP_DENSE:
+            /* wire everywhere, with electrons running all over it */
+            for (y = 0; y < size; y++) {
+                for (x = 0; x < size; x++) {
+                    if (benchRandom(&r) % 100 >= 45) continue;
+                    world->c[getCell(world, x, y)] =
+                        (benchRandom(&r) % 8) ? CELL_CONDUCTOR : CELL_ELECTRON;
+                }
+            }
+            break;
+
+        case MAP_LOOPS:
+            /* small loops, each cycling on its own */
+            for (y = 0; y + 8 <= size; y += 8)
+                for (x = 0; x + 8 <= size; x += 8)
+                    ring(world, x + 1, y + 1, 6, 4 + benchRandom(&r) % 3);
+            break;
+    }
+
+    touchWorld(world);
+    return world;
+}
+
+/* run one scenario */
+static void bench(BenchResult *res, int j, double minSecs, int generic)
+{
+    World *world = benchWorld(res->map, res->size, j, generic, res->blocked);
+    AgentList *agents = newAgentList(world);
+    Agent *agent;
+    static const unsigned char acts[] = {
+        ACT_NOP, ACT_ADVANCE, ACT_TURN_LEFT, ACT_TURN_RIGHT, ACT_BUILD, ACT_HIT
+    };
+    unsigned long r = BENCH_SEED;
+    void *ui;
+    double start, t;
+    int i, misses;
+
+    srandom(BENCH_SEED);
+    for (i = 0; i < res->agents; i++) newAgent(agents, 0, -1, -1);
+    ui = uiInit(0, NULL, agents, res->size, res->size, 1);
+    res->kernelW = world->kernelW;
+    res->blocked = world->blocked;
+
+    /* the workers' misses wouldn't be counted, so don't count any */
+    misses = (j > 1) ? -1 : openMissCounter();
+
+    res->ticks = res->frames = 0;
+    memset(res->phases, 0, sizeof(res->phases));
+    start = now();
+    while (res->ticks < BENCH_MIN_TICKS || now() - start < minSecs) {
+        /* the agents act at random, in process */
+        for (agent = agents->head; agent; agent = agent->next)
+            if (agent->alive) agentReplay(agent, acts[benchRandom(&r) % sizeof(acts)]);
+
+        t = now();
+        countMisses(misses, 1);
+        updateWorld(world, 1);
+        countMisses(misses, 0);
+        res->phases[PHASE_UPDATE] += now() - t;
+
+        t = now();
+        agentProcessLosses(agents);
+        res->phases[PHASE_LOSSES] += now() - t;
+
+        /* nobody reads the messages */
+        t = now();
+        agentServerMessages(agents);
+        res->phases[PHASE_VIEWPORT] += now() - t;
+        for (agent = agents->head; agent; agent = agent->next) agent->wbuf.bufused = 0;
+
+        if (res->ticks % BENCH_FRAME_INTERVAL == 0) {
+            t = now();
+            renderWorld(agents, ui, 1);
+            res->phases[PHASE_DRAW] += now() - t;
+
+            t = now();
+            writeFrame(ui, 1);
+            res->phases[PHASE_PNG] += now() - t;
+            res->frames++;
+        }
+
+        res->ticks++;
+    }
+    res->secs = now() - start;
+
+    res->misses = -1;
+    if (misses >= 0 && read(misses, &res->misses, sizeof(res->misses)) != sizeof(res->misses))
+        res->misses = -1;
+}
+
+static void report(BenchResult *res, int json, int first)
+{
+    double cells = (double) res->size * res->size;
+    double misses = (res->misses < 0) ? -1 : res->misses / (double) res->ticks / cells;
+    const char *layout = res->blocked ? "blocks" : "rows";
+    int p;
+
+    if (json) {
+        printf("%s{\"map\": \"%s\", \"size\": %d, \"agents\": %d, \"kernel\": %d, "
+               "\"layout\": \"%s\", \"ticks\": %lu, \"secs\": %.6f, \"ticks_per_sec\": %.3f, "
+               "\"ns_per_cell\": %.4f, \"misses_per_cell\": %.4f",
+               first ? "[\n  " : ",\n  ",
+               mapNames[res->map], res->size, res->agents, res->kernelW, layout, res->ticks,
+               res->secs, res->ticks / res->secs,
+               res->phases[PHASE_UPDATE] * 1e9 / res->ticks / cells, misses);
+        for (p = 0; p < PHASES; p++)
+            printf(", \"%s_ns\": %.0f", phaseNames[p],
+                   res->phases[p] * 1e9 / ((p >= PHASE_DRAW) ? res->frames : res->ticks));
+        printf("}");
+
+    } else {
+        if (first) {
+            printf("map,size,agents,kernel,layout,ticks,secs,ticks_per_sec,ns_per_cell,misses_per_cell");
+            for (p = 0; p < PHASES; p++) printf(",%s_ns", phaseNames[p]);
+            printf("\n");
+        }
+        printf("%s,%d,%d,%d,%s,%lu,%.6f,%.3f,%.4f,%.4f", mapNames[res->map], res->size,
+               res->agents, res->kernelW, layout, res->ticks, res->secs, res->ticks / res->secs,
+               res->phases[PHASE_UPDATE] * 1e9 / res->ticks / cells, misses);
+        for (p = 0; p < PHASES; p++)
+            printf(",%.0f", res->phases[p] * 1e9 / ((p >= PHASE_DRAW) ? res->frames : res->ticks));
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    int onlyMap = -1, onlySize = -1, onlyAgents = -1, j = 1, json = 0, first = 1, generic = 0;
+    int blocked = 0;
+    int m, i, status;
+    size_t s, a;
+    double minSecs = BENCH_MIN_SECS;
+    char dir[] = "/tmp/rezzo-benchXXXXXX", fnm[64];
+    unsigned long f;
+    pid_t pid;
+    BenchResult res;
+
+    for (i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        char *nextarg = (i < argc - 1) ? argv[i+1] : NULL;
+#define ARG(x) if (!strcmp(arg, #x))
+#define ARGN(x) if (!strcmp(arg, #x) && nextarg)
+        ARGN(-m) {
+            for (onlyMap = 0; onlyMap < MAPS && strcmp(mapNames[onlyMap], nextarg); onlyMap++);
+            i++;
+        } else ARGN(-s) {
+            onlySize = atoi(nextarg);
+            i++;
+        } else ARGN(-a) {
+            onlyAgents = atoi(nextarg);
+            i++;
+        } else ARGN(-j) {
+            j = atoi(nextarg);
+            i++;
+        } else ARGN(-T) {
+            minSecs = atof(nextarg);
+            i++;
+        } else ARG(-J) {
+            json = 1;
+        } else ARG(-G) {
+            generic = 1;
+        } else ARG(-B) {
+            blocked = 1;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n%s", arg, help_text);
+            exit(1);
+        }
+    }
+
+    /* the frames have to go somewhere */
+    if (!mkdtemp(dir)) {
+        perror(dir);
+        exit(1);
+    }
+    video = dir;
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        if (onlySize >= 0 && sizes[s] != onlySize) continue;
+        for (m = 0; m < MAPS; m++) {
+            if (onlyMap >= 0 && m != onlyMap) continue;
+            for (a = 0; a < sizeof(agentCounts) / sizeof(agentCounts[0]); a++) {
+                if (onlyAgents >= 0 && agentCounts[a] != onlyAgents) continue;
+                res.map = m;
+                res.size = sizes[s];
+                res.agents = agentCounts[a];
+                res.blocked = blocked;
+
+                /* worlds are never freed, so each scenario gets a process */
+                SF(pid, fork, -1, ());
+                if (pid == 0) {
+                    bench(&res, j, minSecs, generic);
+                    report(&res, json, first);
+                    for (f = 1; f <= frame; f++) {
+                        sprintf(fnm, "%s/%08lu.png", dir, f);
+                        unlink(fnm);
+                    }
+                    exit(0);
+                }
+                SF(pid, waitpid, -1, (pid, &status, 0));
+                if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+                    fprintf(stderr, "%s %d %d failed\n", mapNames[m], sizes[s], agentCounts[a]);
+                    exit(1);
+                }
+                first = 0;
+            }
+        }
+    }
+    if (json) printf(first ? "[]\n" : "\n]\n");
+    rmdir(dir);
+
+    return 0;
+}
@@ -0,0 +1,657 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitboard.h"
+#include "helpers.h"
+#include "pool.h"
+
+static uint64_t *newPlane(Bitboard *bb)
+{
+    uint64_t *ret;
+    size_t sz = sizeof(uint64_t) * bb->bw * (bb->h + 2);
+    SF(ret, malloc, NULL, (sz));
+    memset(ret, 0, sz);
+    return ret;
+}
+
+/* allocate bitboards for a world of this size */
+static Bitboard *newBitboard(int w, int h)
+{
+    Bitboard *ret;
+    SF(ret, malloc, NULL, (sizeof(Bitboard)));
+    memset(ret, 0, sizeof(Bitboard));
+    ret->w = w;
+    ret->h = h;
+    ret->bw = (w + 2 + 63) / 64;
+    ret->conductor = newPlane(ret);
+    ret->electron = newPlane(ret);
+    ret->tail = newPlane(ret);
+    ret->nconductor = newPlane(ret);
+    ret->nelectron = newPlane(ret);
+    ret->ntail = newPlane(ret);
+    INIT_BUFFER(ret->specials);
+    INIT_BUFFER(ret->nspecials);
+    INIT_BUFFER(ret->photons);
+    INIT_BUFFER(ret->events);
+    INIT_BUFFER(ret->owners);
+    return ret;
+}
+
+#define BIT_WORD(bb, x, y) (((y)+1)*(bb)->bw + (((x)+1)>>6))
+#define BIT_MASK(x) ((uint64_t) 1 << (((x)+1)&63))
+
+/* the number of cell (x, y), y*w+x, worked out in size_t. It fits in an
+ * unsigned int, since only worlds of up to UINT_MAX cells get bitboards */
+#define BIT_CELL(bb, x, y) ((unsigned int) ((size_t) (y)*(bb)->w + (x)))
+
+/* get a bit from a plane at a location which may be out of bounds */
+static int getBit(Bitboard *bb, uint64_t *plane, int x, int y)
+{
+    if (x < 0) x += bb->w;
+    else if (x >= bb->w) x -= bb->w;
+    if (y < 0) y += bb->h;
+    else if (y >= bb->h) y -= bb->h;
+    return !!(plane[BIT_WORD(bb, x, y)] & BIT_MASK(x));
+}
+
+/* find the special cell at this location, which may be out of bounds */
+static BitSpecial *getSpecial(Bitboard *bb, int x, int y)
+{
+    BitSpecial *specials = bb->specials.buf;
+    unsigned int cell;
+    size_t lo, hi, mid;
+
+    if (x < 0) x += bb->w;
+    else if (x >= bb->w) x -= bb->w;
+    if (y < 0) y += bb->h;
+    else if (y >= bb->h) y -= bb->h;
+    cell = BIT_CELL(bb, x, y);
+
+    lo = 0;
+    hi = bb->specials.bufused;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        if (specials[mid].cell < cell) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < bb->specials.bufused && specials[lo].cell == cell)
+        return specials + lo;
+    return NULL;
+}
+
+/* convert a world into bitboards */
+static void packWorld(Bitboard *bb, World *world)
+{
+    int x, y, p, n;
+    size_t i;
+    unsigned char c;
+    uint64_t *con, *ele, *tai, m;
+    BitSpecial s;
+
+    memset(bb->conductor, 0, sizeof(uint64_t) * bb->bw * (bb->h + 2));
+    memset(bb->electron, 0, sizeof(uint64_t) * bb->bw * (bb->h + 2));
+    memset(bb->tail, 0, sizeof(uint64_t) * bb->bw * (bb->h + 2));
+    bb->specials.bufused = 0;
+
+    for (y = 0; y < bb->h; y++) {
+        con = bb->conductor + (y+1)*bb->bw;
+        ele = bb->electron + (y+1)*bb->bw;
+        tai = bb->tail + (y+1)*bb->bw;
+        for (x = 0, p = 1, n = 0; x < bb->w; x++, p++, i++, n--) {
+            if (!n) i = cellRun(world, x, y, &n);
+            c = world->c[i];
+            m = (uint64_t) 1 << (p&63);
+            con[p>>6] |= (c == CELL_CONDUCTOR) ? m : 0;
+            ele[p>>6] |= (c == CELL_ELECTRON) ? m : 0;
+            tai[p>>6] |= (c == CELL_ELECTRON_TAIL) ? m : 0;
+            if (c != CELL_NONE && c != CELL_CONDUCTOR && c != CELL_ELECTRON &&
+                c != CELL_ELECTRON_TAIL) {
+                s.cell = BIT_CELL(bb, x, y);
+                s.c = c;
+                s.owner = cellMapGet(&world->owners, i);
+                WRITE_ONE_BUFFER(bb->specials, s);
+            }
+        }
+    }
+}
+
+/* convert bitboards back into a world. Only cells which changed are written,
+ * so that blank pages of the world aren't allocated */
+static void unpackWorld(Bitboard *bb, World *world)
+{
+    static const unsigned char states[4] = {
+        CELL_NONE, CELL_CONDUCTOR, CELL_ELECTRON, CELL_ELECTRON_TAIL
+    };
+    int x, y, p, n;
+    size_t i, si;
+    uint64_t *con, *ele, *tai;
+    unsigned char c;
+    BitSpecial *s;
+
+    /* first the Wireworld states, which are exclusive */
+    for (y = 0; y < bb->h; y++) {
+        con = bb->conductor + (y+1)*bb->bw;
+        ele = bb->electron + (y+1)*bb->bw;
+        tai = bb->tail + (y+1)*bb->bw;
+        for (x = 0, p = 1, n = 0; x < bb->w; x++, p++, i++, n--) {
+            if (!n) i = cellRun(world, x, y, &n);
+            c = states[
+                ((con[p>>6] >> (p&63)) & 1) |
+                (((ele[p>>6] >> (p&63)) & 1) << 1) |
+                (((tai[p>>6] >> (p&63)) & 1) * 3)];
+            if (world->c[i] != c) world->c[i] = c;
+        }
+    }
+
+    /* then everything else */
+    for (si = 0; si < bb->specials.bufused; si++) {
+        s = bb->specials.buf + si;
+        world->c[CELL_AT(world, s->cell % bb->w, s->cell / bb->w)] = s->c;
+    }
+}
+
+/* copy the edges of the electron plane into its halo */
+static void refreshBitHalo(Bitboard *bb)
+{
+    int y, w = bb->w, bw = bb->bw;
+    uint64_t *e = bb->electron;
+
+    for (y = 0; y < bb->h; y++) {
+        /* x = -1 mirrors x = w-1, and x = w mirrors x = 0 */
+        e[BIT_WORD(bb, -1, y)] &= ~BIT_MASK(-1);
+        if (e[BIT_WORD(bb, w-1, y)] & BIT_MASK(w-1))
+            e[BIT_WORD(bb, -1, y)] |= BIT_MASK(-1);
+        e[BIT_WORD(bb, w, y)] &= ~BIT_MASK(w);
+        if (e[BIT_WORD(bb, 0, y)] & BIT_MASK(0))
+            e[BIT_WORD(bb, w, y)] |= BIT_MASK(w);
+    }
+
+    memcpy(e, e + bb->h*bw, sizeof(uint64_t) * bw);
+    memcpy(e + (bb->h+1)*bw, e + bw, sizeof(uint64_t) * bw);
+}
+
+/* add a one-bit value into a per-bit counter which saturates at 4 */
+#define ADD_BIT(v) do { \
+    uint64_t _v = (v), _c0, _c1; \
+    _c0 = s0 & _v; \
+    s0 ^= _v; \
+    _c1 = s1 & _c0; \
+    s1 ^= _c0; \
+    over |= _c1; \
+} while (0)
+
+/* step the Wireworld states of rows y to ye-1. Special cells are left for
+ * fixSpecials. Inlined into stepBand, GCC makes a much slower job of it */
+__attribute__((noinline)) static void stepRowRange(Bitboard *bb, int y, int ye)
+{
+    int bw = bb->bw, k, i;
+    uint64_t *con = bb->conductor, *ele = bb->electron, *tai = bb->tail;
+    uint64_t *ncon = bb->nconductor, *nele = bb->nelectron, *ntai = bb->ntail;
+
+    for (; y < ye; y++) {
+        uint64_t *up = ele + y*bw, *mid = up + bw, *dn = mid + bw;
+        for (k = 0, i = (y+1)*bw; k < bw; k++, i++) {
+            uint64_t s0 = 0, s1 = 0, over = 0, n12;
+            uint64_t pu = k ? up[k-1] : 0, pm = k ? mid[k-1] : 0, pd = k ? dn[k-1] : 0;
+            uint64_t nu = (k < bw-1) ? up[k+1] : 0, nm = (k < bw-1) ? mid[k+1] : 0,
+                     nd = (k < bw-1) ? dn[k+1] : 0;
+
+            /* count the electron neighbors, up to 4 */
+            ADD_BIT((up[k] << 1) | (pu >> 63));
+            ADD_BIT(up[k]);
+            ADD_BIT((up[k] >> 1) | (nu << 63));
+            ADD_BIT((mid[k] << 1) | (pm >> 63));
+            ADD_BIT((mid[k] >> 1) | (nm << 63));
+            ADD_BIT((dn[k] << 1) | (pd >> 63));
+            ADD_BIT(dn[k]);
+            ADD_BIT((dn[k] >> 1) | (nd << 63));
+            n12 = (s0 ^ s1) & ~over;
+
+            /* conductor -> electron on 1 or 2, electron -> tail, tail -> conductor */
+            nele[i] = con[i] & n12;
+            ntai[i] = ele[i];
+            ncon[i] = tai[i] | (con[i] & ~n12);
+        }
+    }
+}
+#undef ADD_BIT
+
+static int specialCmp(const void *lv, const void *rv)
+{
+    const BitSpecial *l = lv, *r = rv;
+    if (l->cell < r->cell) return -1;
+    if (l->cell > r->cell) return 1;
+    return 0;
+}
+
+/* the world row of this row of a scratch bitboard */
+static int worldRow(Bitboard *bb, World *world, int y)
+{
+    y = (bb->y0 + y) % world->h;
+    return (y < 0) ? y + world->h : y;
+}
+
+/* is this row of a scratch bitboard one it keeps? */
+#define KEEP_ROW(bb, y) ((y) >= (bb)->keep0 && (y) < (bb)->keep1)
+
+/* the owner of a cell of a scratch bitboard, as of this tick */
+static unsigned char bitOwner(Bitboard *bb, World *world, int x, int y)
+{
+    OwnerChange *oc;
+    unsigned int cell = BIT_CELL(bb, x, y);
+
+    /* the world's owners are only updated once the run is over */
+    for (oc = bb->owners.buf + bb->owners.bufused; oc > bb->owners.buf; oc--) {
+        if (oc[-1].cell == cell) return oc[-1].owner;
+    }
+    return cellMapGet(&world->owners, CELL_AT(world, x, worldRow(bb, world, y)));
+}
+
+/* change the owner of a cell of a scratch bitboard */
+static void setBitOwner(Bitboard *bb, World *world, int x, int y, unsigned char owner)
+{
+    OwnerChange oc;
+    oc.cell = BIT_CELL(bb, x, y);
+    oc.owner = owner;
+    WRITE_ONE_BUFFER(bb->owners, oc);
+    if (KEEP_ROW(bb, y)) {
+        oc.cell = CELL_AT(world, x, worldRow(bb, world, y));
+        WRITE_ONE_BUFFER(bb->band->owners, oc);
+    }
+}
+
+/* add an event at this special cell to bb->events */
+static void addBitEvent(Bitboard *bb, World *world, int type, BitSpecial *s,
+                        unsigned char owner)
+{
+    Event ev;
+    int y = s->cell / bb->w;
+    if (!KEEP_ROW(bb, y)) return;
+    ev.type = type;
+    ev.owner = owner;
+    ev.ts = bb->ts;
+    ev.x = s->cell % bb->w;
+    ev.y = worldRow(bb, world, y);
+    WRITE_ONE_BUFFER(bb->events, ev);
+}
+
+/* add this tick's events to the band's in row-major order, same as the byte
+ * engine would */
+static void writeBitEvents(Bitboard *bb, World *world)
+{
+    Event *l = bb->events.buf, *le = l + bb->events.bufused, ev;
+    BitSpecial *r = bb->photons.buf, *re = r + bb->photons.bufused;
+    unsigned int first = BIT_CELL(bb, 0, bb->keep0), last = BIT_CELL(bb, 0, bb->keep1);
+
+    /* the kept rows are contiguous in the world, so comparing world cells
+     * is the same as comparing ours */
+    while (r < re && r->cell < first) r++;
+    while (re > r && re[-1].cell >= last) re--;
+    while (l < le || r < re) {
+        if (r == re || (l < le &&
+            BIT_CELL(bb, l->x, l->y) < BIT_CELL(bb, r->cell % bb->w, worldRow(bb, world, r->cell / bb->w)))) {
+            WRITE_ONE_BUFFER(bb->band->events, *l);
+            l++;
+        } else {
+            ev.type = EVENT_PHOTON;
+            ev.owner = r->owner;
+            ev.ts = bb->ts;
+            ev.x = r->cell % bb->w;
+            ev.y = worldRow(bb, world, r->cell / bb->w);
+            WRITE_ONE_BUFFER(bb->band->events, ev);
+            r++;
+        }
+    }
+}
+
+/* set a cell which stopped being special to conductor, in the next state */
+static void specialToConductor(Bitboard *bb, World *world, BitSpecial *s, unsigned char owner)
+{
+    int x = s->cell % bb->w, y = s->cell / bb->w;
+    bb->nconductor[BIT_WORD(bb, x, y)] |= BIT_MASK(x);
+    setBitOwner(bb, world, x, y, owner);
+}
+
+/* apply the rules involving photons, flags and geysers to a scratch bitboard,
+ * in row-major order */
+static void fixSpecials(Bitboard *bb, World *world)
+{
+    BitSpecial *s, *n, ns;
+    int x, y, sx, sy, ex, ey, tails;
+    size_t si;
+    unsigned char newOwner;
+
+    bb->nspecials.bufused = 0;
+    bb->photons.bufused = 0;
+    bb->events.bufused = 0;
+
+    for (si = 0; si < bb->specials.bufused; si++) {
+        s = bb->specials.buf + si;
+        ns = *s;
+        x = s->cell % bb->w;
+        y = s->cell / bb->w;
+
+        if (s->c == CELL_FLAG || s->c == CELL_FLAG_GEYSER) {
+            /* electrons next to flags with tails next to them become photons */
+            for (sy = y - 1; sy <= y + 1; sy++) {
+                for (sx = x - 1; sx <= x + 1; sx++) {
+                    int wx = (sx + bb->w) % bb->w, wy = (sy + bb->h) % bb->h;
+                    if (!getBit(bb, bb->electron, wx, wy)) continue;
+                    if (!(bb->ntail[BIT_WORD(bb, wx, wy)] & BIT_MASK(wx))) continue; /* already a photon */
+
+                    tails = 0;
+                    for (ey = wy - 1; ey <= wy + 1 && !tails; ey++) {
+                        for (ex = wx - 1; ex <= wx + 1; ex++) {
+                            if (getBit(bb, bb->tail, ex, ey)) {
+                                tails = 1;
+                                break;
+                            }
+                        }
+                    }
+                    if (tails) {
+                        BitSpecial p;
+                        bb->ntail[BIT_WORD(bb, wx, wy)] &= ~BIT_MASK(wx);
+                        p.cell = BIT_CELL(bb, wx, wy);
+                        p.c = CELL_PHOTON;
+                        p.owner = bitOwner(bb, world, wx, wy);
+                        WRITE_ONE_BUFFER(bb->photons, p);
+                    }
+                }
+            }
+        }
+
+        if (s->c == CELL_FLAG) {
+            int dissipate = 0;
+
+            /* check for bases (for losses) and photons (for dissipation) */
+            for (sy = y - 1; sy <= y + 1; sy++) {
+                for (sx = x - 1; sx <= x + 1; sx++) {
+                    n = getSpecial(bb, sx, sy);
+                    if (!n) continue;
+                    if (n->c == CELL_BASE && n->owner != s->owner && KEEP_ROW(bb, y)) {
+                        BitLoss loss;
+                        loss.tick = bb->tick;
+                        loss.owner = s->owner;
+                        WRITE_ONE_BUFFER(bb->band->losses, loss);
+                        if (world->events) addBitEvent(bb, world, EVENT_LOSS, s, s->owner);
+                    } else if (n->c == CELL_PHOTON)
+                        dissipate = 1;
+                }
+            }
+
+            if (dissipate) {
+                if (world->events) addBitEvent(bb, world, EVENT_FLAG_DISSIPATED, s, s->owner);
+                specialToConductor(bb, world, s, 0);
+                continue;
+            }
+
+        } else if (s->c == CELL_PHOTON) {
+            /* become a flag if all neighboring flags agree on an owner */
+            newOwner = 0;
+            for (sy = y - 1; sy <= y + 1; sy++) {
+                for (sx = x - 1; sx <= x + 1; sx++) {
+                    n = getSpecial(bb, sx, sy);
+                    if (!n || (n->c != CELL_FLAG && n->c != CELL_FLAG_GEYSER)) continue;
+                    if (newOwner != 0 && n->owner != newOwner)
+                        goto photonDissipates;
+                    newOwner = n->owner;
+                }
+            }
+            if (newOwner != 0) {
+                ns.c = CELL_FLAG;
+                ns.owner = newOwner;
+                setBitOwner(bb, world, x, y, newOwner);
+                if (world->events) addBitEvent(bb, world, EVENT_FLAG, s, newOwner);
+            } else {
+photonDissipates:
+                specialToConductor(bb, world, s, s->owner);
+                continue;
+            }
+
+        }
+
+        WRITE_ONE_BUFFER(bb->nspecials, ns);
+    }
+
+    /* merge in the new photons */
+    if (bb->photons.bufused) {
+        struct Buffer_BitSpecial tmp;
+        BitSpecial *l, *le, *r, *re;
+
+        qsort(bb->photons.buf, bb->photons.bufused, sizeof(BitSpecial), specialCmp);
+        if (world->events) writeBitEvents(bb, world);
+        tmp = bb->specials;
+        bb->specials = bb->nspecials;
+        bb->nspecials = tmp;
+        bb->nspecials.bufused = 0;
+
+        l = bb->specials.buf;
+        le = l + bb->specials.bufused;
+        r = bb->photons.buf;
+        re = r + bb->photons.bufused;
+        while (l < le || r < re) {
+            if (r == re || (l < le && l->cell < r->cell)) {
+                WRITE_ONE_BUFFER(bb->nspecials, *l);
+                l++;
+            } else {
+                WRITE_ONE_BUFFER(bb->nspecials, *r);
+                r++;
+            }
+        }
+
+    } else if (world->events) {
+        writeBitEvents(bb, world);
+
+    }
+}
+
+/* swap in the new state of a bitboard */
+static void swapBitboard(Bitboard *bb)
+{
+    uint64_t *tmp;
+    struct Buffer_BitSpecial tmpb;
+
+    tmp = bb->conductor; bb->conductor = bb->nconductor; bb->nconductor = tmp;
+    tmp = bb->electron; bb->electron = bb->nelectron; bb->nelectron = tmp;
+    tmp = bb->tail; bb->tail = bb->ntail; bb->ntail = tmp;
+    tmpb = bb->specials; bb->specials = bb->nspecials; bb->nspecials = tmpb;
+}
+
+/* run a band of bb through bb->depth ticks in the scratch bitboard sb. It
+ * takes the band and depth rows either side, since information moves at most
+ * a row a tick, and what's wrong spreads in from its edges just as slowly */
+static void stepBand(Bitboard *bb, Bitboard *sb, BitBand *band)
+{
+    World *world = bb->world;
+    int bw = bb->bw, y, wy, t;
+    size_t rowsz = sizeof(uint64_t) * bw;
+    BitSpecial *s, *se, ns;
+    unsigned int cell;
+    size_t lo, hi, mid;
+
+    sb->h = band->rows + 2*bb->depth;
+    sb->y0 = band->y - bb->depth;
+    sb->keep0 = bb->depth;
+    sb->keep1 = bb->depth + band->rows;
+    sb->band = band;
+    sb->specials.bufused = 0;
+    sb->owners.bufused = 0;
+    band->specials.bufused = 0;
+    band->losses.bufused = 0;
+    band->events.bufused = 0;
+    band->owners.bufused = 0;
+
+    /* copy in our rows and their specials */
+    for (y = 0; y < sb->h; y++) {
+        wy = worldRow(sb, world, y);
+        memcpy(sb->conductor + (y+1)*bw, bb->conductor + (wy+1)*bw, rowsz);
+        memcpy(sb->electron + (y+1)*bw, bb->electron + (wy+1)*bw, rowsz);
+        memcpy(sb->tail + (y+1)*bw, bb->tail + (wy+1)*bw, rowsz);
+
+        cell = BIT_CELL(bb, 0, wy);
+        lo = 0;
+        hi = bb->specials.bufused;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+            if (bb->specials.buf[mid].cell < cell) lo = mid + 1;
+            else hi = mid;
+        }
+        se = bb->specials.buf + bb->specials.bufused;
+        for (s = bb->specials.buf + lo; s < se && s->cell < cell + bb->w; s++) {
+            ns = *s;
+            ns.cell = BIT_CELL(bb, s->cell - cell, y);
+            WRITE_ONE_BUFFER(sb->specials, ns);
+        }
+    }
+
+    for (t = 0; t < bb->depth; t++) {
+        sb->tick = t;
+        sb->ts = bb->ts + t + 1;
+        refreshBitHalo(sb);
+        /* rows nearer the edges than this are wrong by now anyway */
+        stepRowRange(sb, t, sb->h - t);
+        fixSpecials(sb, world);
+        swapBitboard(sb);
+    }
+
+    /* and copy out the rows we keep */
+    for (y = sb->keep0; y < sb->keep1; y++) {
+        wy = band->y + y - sb->keep0;
+        memcpy(bb->nconductor + (wy+1)*bw, sb->conductor + (y+1)*bw, rowsz);
+        memcpy(bb->nelectron + (wy+1)*bw, sb->electron + (y+1)*bw, rowsz);
+        memcpy(bb->ntail + (wy+1)*bw, sb->tail + (y+1)*bw, rowsz);
+    }
+    se = sb->specials.buf + sb->specials.bufused;
+    for (s = sb->specials.buf; s < se; s++) {
+        y = s->cell / bb->w;
+        if (!KEEP_ROW(sb, y)) continue;
+        ns = *s;
+        ns.cell = BIT_CELL(bb, s->cell % bb->w, band->y + y - sb->keep0);
+        WRITE_ONE_BUFFER(band->specials, ns);
+    }
+}
+
+/* step the bands handed out by poolNext */
+static void stepBands(void *bbvp, int worker, int workers)
+{
+    Bitboard *bb = bbvp;
+    int b;
+    (void) workers;
+
+    while ((b = poolNext(&bb->nextBand, bb->nbands)) >= 0)
+        stepBand(bb, bb->scratch[worker], bb->bands + b);
+}
+
+/* collect what happened in the bands into the world and bb, in the order the
+ * byte engine would have done it */
+static void mergeBands(Bitboard *bb, World *world)
+{
+    BitBand *band;
+    BitLoss *loss;
+    Event *ev;
+    OwnerChange *oc;
+    int b, t;
+    size_t *lossAt, *eventAt;
+
+    SF(lossAt, calloc, NULL, (bb->nbands, sizeof(size_t)));
+    SF(eventAt, calloc, NULL, (bb->nbands, sizeof(size_t)));
+    for (t = 0; t < bb->depth; t++) {
+        for (b = 0; b < bb->nbands; b++) {
+            band = bb->bands + b;
+            for (; lossAt[b] < band->losses.bufused; lossAt[b]++) {
+                loss = band->losses.buf + lossAt[b];
+                if (loss->tick != t) break;
+                markLoss(world->losses, loss->owner);
+            }
+            for (; eventAt[b] < band->events.bufused; eventAt[b]++) {
+                ev = band->events.buf + eventAt[b];
+                if (ev->ts != (unsigned char) (bb->ts + t + 1)) break;
+                writeEvent(world->events, ev);
+            }
+        }
+    }
+    free(lossAt);
+    free(eventAt);
+
+    bb->nspecials.bufused = 0;
+    for (b = 0; b < bb->nbands; b++) {
+        band = bb->bands + b;
+        for (oc = band->owners.buf; oc < band->owners.buf + band->owners.bufused; oc++)
+            setOwner(world, oc->cell, oc->owner);
+        while (bb->nspecials.bufsz < bb->nspecials.bufused + band->specials.bufused)
+            EXPAND_BUFFER(bb->nspecials);
+        memcpy(bb->nspecials.buf + bb->nspecials.bufused, band->specials.buf,
+               sizeof(BitSpecial) * band->specials.bufused);
+        bb->nspecials.bufused += band->specials.bufused;
+    }
+}
+
+/* set up the bands of bb and a scratch bitboard for each worker */
+static void initBands(Bitboard *bb, World *world)
+{
+    int workers = world->pool ? world->pool->workers : 1, b;
+
+    if (!bb->bands) {
+        bb->nbands = (bb->h + BITBOARD_BAND - 1) / BITBOARD_BAND;
+        SF(bb->bands, malloc, NULL, (sizeof(BitBand) * bb->nbands));
+        for (b = 0; b < bb->nbands; b++) {
+            bb->bands[b].y = b * BITBOARD_BAND;
+            bb->bands[b].rows = (b == bb->nbands - 1) ? bb->h - b * BITBOARD_BAND : BITBOARD_BAND;
+            INIT_BUFFER(bb->bands[b].specials);
+            INIT_BUFFER(bb->bands[b].losses);
+            INIT_BUFFER(bb->bands[b].events);
+            INIT_BUFFER(bb->bands[b].owners);
+        }
+    }
+
+    if (bb->nscratch < workers) {
+        SF(bb->scratch, realloc, NULL, (bb->scratch, sizeof(Bitboard *) * workers));
+        for (; bb->nscratch < workers; bb->nscratch++)
+            bb->scratch[bb->nscratch] = newBitboard(bb->w, BITBOARD_BAND + 2*BITBOARD_DEPTH);
+    }
+}
+
+/* run iter ticks of world as bitboards */
+void updateWorldBits(World *world, int iter)
+{
+    Bitboard *bb;
+
+    if (!world->bits) world->bits = newBitboard(world->w, world->h);
+    bb = world->bits;
+    bb->world = world;
+    initBands(bb, world);
+    packWorld(bb, world);
+
+    while (iter > 0) {
+        bb->depth = (iter < BITBOARD_DEPTH) ? iter : BITBOARD_DEPTH;
+        bb->ts = world->ts;
+        bb->nextBand = 0;
+        poolRun(world->pool, stepBands, bb);
+        mergeBands(bb, world);
+        swapBitboard(bb);
+        world->ts += bb->depth;
+        iter -= bb->depth;
+    }
+
+    unpackWorld(bb, world);
+
+    /* anything may have changed, so let the tiles sort themselves out */
+    touchWorld(world);
+}
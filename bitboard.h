@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef BITBOARD_H
+#define BITBOARD_H
+
+#include <stdint.h>
+
+#include "buffer.h"
+#include "ca.h"
+
+/* below this many ticks, converting to and from bitboards isn't worth it */
+#define BITBOARD_MIN_ITER 8
+
+/* the world is stepped in bands of this many rows, each of which is run this
+ * many ticks at a time while it's in cache */
+#define BITBOARD_BAND 64
+#define BITBOARD_DEPTH 8
+
+typedef struct _Bitboard Bitboard;
+typedef struct _BitSpecial BitSpecial;
+typedef struct _BitLoss BitLoss;
+typedef struct _BitBand BitBand;
+
+/* any cell which isn't blank, conductor, electron or tail */
+struct _BitSpecial {
+    unsigned int cell; /* y*w+x, so that lists of them sort row-major */
+    unsigned char c, owner;
+};
+
+BUFFER(BitSpecial, BitSpecial);
+
+/* a loss in some tick of a band */
+struct _BitLoss {
+    unsigned char tick, owner;
+};
+
+BUFFER(BitLoss, BitLoss);
+
+/* the rows y to y+rows-1 of the world, and what became of them in the last
+ * run of ticks. Everything is by world cell, and in tick then row-major order */
+struct _BitBand {
+    int y, rows;
+    struct Buffer_BitSpecial specials;
+    struct Buffer_BitLoss losses;
+    struct Buffer_Event events;
+    struct Buffer_OwnerChange owners;
+};
+
+/* the conductor, electron and tail states as bit-planes, 64 cells to a word.
+ * Each row has a one-bit halo on either side, and there's a halo row above
+ * and below, so cell (x, y) is bit x+1 of row y+1 */
+struct _Bitboard {
+    int w, h, bw; /* size, and words per row */
+    uint64_t *conductor, *electron, *tail; /* current state */
+    uint64_t *nconductor, *nelectron, *ntail; /* next state */
+
+    /* special cells, sorted, the ones being built for the next tick, and
+     * the photons created this tick */
+    struct Buffer_BitSpecial specials, nspecials, photons;
+
+    /* events of this tick, other than photons being created */
+    struct Buffer_Event events;
+
+    /* for the whole world: its bands, the scratch bitboard of each worker,
+     * and the ticks in this run */
+    BitBand *bands;
+    int nbands;
+    Bitboard **scratch;
+    int nscratch, depth;
+    volatile int nextBand;
+    World *world;
+
+    /* for a scratch bitboard: the world row of its row 0, the rows it keeps,
+     * the band they go to, the tick it's on and its ts, and the owner
+     * changes it's made, by its own cells */
+    int y0, keep0, keep1;
+    BitBand *band;
+    int tick;
+    unsigned char ts;
+    struct Buffer_OwnerChange owners;
+};
+
+/* run iter ticks of world as bitboards, with the same result as updateWorld */
+void updateWorldBits(World *world, int iter);
+
+#endif
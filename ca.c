@@ -16,18 +16,36 @@
 
 #define _BSD_SOURCE /* for random */
 
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #ifndef __WIN32
-#include <alloca.h>
-#else
-#include <malloc.h>
+#include <sys/mman.h>
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
 #endif
 
+#include "bitboard.h"
 #include "ca.h"
+#include "hashlife.h"
 #include "helpers.h"
+#include "park.h"
+#include "pool.h"
+
+/* per-cell arrays at least this big get huge pages */
+#define HUGE_PAGE_SZ (2*1024*1024)
+
+/* maps are generated in pieces of MAPGEN_SZ x MAPGEN_SZ cells */
+#define MAPGEN_SHIFT 6
+#define MAPGEN_SZ (1<<MAPGEN_SHIFT)
 
 const CardinalityHelper cardinalityHelpers[] = {
     {1, 0, 0, 1},
@@ -36,31 +54,137 @@ const CardinalityHelper cardinalityHelpers[] = {
     {0, -1, 1, 0}
 };
 
+/* allocate zeroed memory for a per-cell array. Big ones are mapped, with
+ * huge pages if enough are reserved and otherwise asking for transparent
+ * ones, since the TLB can't cover them in 4K pages. In the latter case a page
+ * is the kernel's shared zero page until it's written, so blank stretches of
+ * a huge world cost nothing so long as nothing writes to them */
+static void *allocCells(size_t sz)
+{
+    void *ret;
+
+#ifdef MAP_ANONYMOUS
+    if (sz >= HUGE_PAGE_SZ) {
+#ifdef MAP_HUGETLB
+        ret = mmap(NULL, (sz + HUGE_PAGE_SZ - 1) & ~((size_t) HUGE_PAGE_SZ - 1),
+                   PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (ret != MAP_FAILED) return ret;
+#endif
+        SF(ret, mmap, MAP_FAILED, (NULL, sz, PROT_READ|PROT_WRITE,
+                                   MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0));
+#ifdef MADV_HUGEPAGE
+        madvise(ret, sz, MADV_HUGEPAGE);
+#endif
+        return ret;
+    }
+#endif
+
+    SF(ret, calloc, NULL, (sz, 1));
+    return ret;
+}
+
+/* allocate a per-cell array, with its halo */
+static unsigned char *newCells(World *world, unsigned char fill)
+{
+    unsigned char *ret;
+    ret = allocCells(world->csz);
+    if (fill) memset(ret, fill, world->csz);
+    return ret + world->pitch + 1;
+}
+
+/* allocate bits per cell, all clear. There's a spare word at the end, so
+ * that any 16 of them can be read at once */
+unsigned char *newCellBits(World *world)
+{
+    unsigned char *ret;
+    size_t sz = ((world->csz + 7) >> 3) + sizeof(uint32_t);
+    SF(ret, calloc, NULL, (sz, 1));
+    return ret;
+}
+
+/* expect a new world to stay mostly blank. Its cells are allocated a page at a
+ * time as they're written, and a huge page spans many whole rows, so they
+ * should be small pages */
+void sparseWorld(World *world)
+{
+#ifdef MADV_NOHUGEPAGE
+    if (world->csz >= HUGE_PAGE_SZ) {
+        madvise(world->c - world->pitch - 1, world->csz, MADV_NOHUGEPAGE);
+        madvise(world->c2 - world->pitch - 1, world->csz, MADV_NOHUGEPAGE);
+    }
+#endif
+}
+
 /* allocate a world */
-World *newWorld(int w, int h)
+World *newWorld(int w, int h, int blocked)
+{
+    return newWorldFrom(w, h, blocked, NULL, NULL);
+}
+
+/* allocate a world around existing cells */
+World *newWorldFrom(int w, int h, int blocked, unsigned char *c, unsigned char *c2)
 {
     World *ret;
+    int i;
 
     /* allocate it */
     SF(ret, malloc, NULL, (sizeof(World)));
+    ret->engine = engines;
     ret->ts = 0;
     ret->losses[0] = 0;
     ret->w = w;
     ret->h = h;
-    SF(ret->c, malloc, NULL, (w*h));
-    memset(ret->c, CELL_NONE, w*h);
-    SF(ret->c2, malloc, NULL, (w*h));
-    SF(ret->owner, malloc, NULL, (w*h));
-    memset(ret->owner, 0, w*h);
-    SF(ret->o2, malloc, NULL, (w*h));
-    SF(ret->damage, malloc, NULL, (w*h));
-    memset(ret->damage, 0, w*h);
+    ret->blocked = blocked && !(w % BLOCK_SZ) && !(h % BLOCK_SZ);
+    if (ret->blocked) {
+        ret->pitch = BLOCK_PITCH;
+        ret->bw = w >> BLOCK_SHIFT;
+        ret->csz = (size_t) ret->bw * (h >> BLOCK_SHIFT) * BLOCK_CELLS;
+    } else {
+        ret->pitch = w + 2;
+        ret->bw = 1;
+        ret->csz = (size_t) ret->pitch * (h + 2);
+    }
+    ret->c = c ? c : newCells(ret, CELL_NONE);
+    ret->c2 = c2 ? c2 : newCells(ret, CELL_NONE);
+    ret->parked = newCellBits(ret);
+    initCellMap(&ret->owners);
+    initCellMap(&ret->damage);
+
+    /* and the tiles, which all start inactive since the world is blank */
+    ret->tw = (w + TILE_SZ - 1) >> TILE_SHIFT;
+    ret->th = (h + TILE_SZ - 1) >> TILE_SHIFT;
+    SF(ret->active, malloc, NULL, (ret->tw*ret->th));
+    memset(ret->active, 0, ret->tw*ret->th);
+    SF(ret->sweep, malloc, NULL, (ret->tw*ret->th));
+    SF(ret->stale, malloc, NULL, (ret->tw*ret->th));
+    memset(ret->stale, 0, ret->tw*ret->th);
+    SF(ret->tileLosses, malloc, NULL, (ret->th*LOSSES_SZ));
+    SF(ret->tileOwners, malloc, NULL, (ret->th*sizeof(struct Buffer_OwnerChange)));
+    SF(ret->tileEvents, malloc, NULL, (ret->th*sizeof(struct Buffer_Event)));
+    for (i = 0; i < ret->th; i++) {
+        INIT_BUFFER(ret->tileOwners[i]);
+        INIT_BUFFER(ret->tileEvents[i]);
+    }
+    ret->events = NULL;
+
+    /* and the owned cells, of which there are none */
+    memset(ret->owned, 0, sizeof(ret->owned));
+    ret->ow = (w + OCC_SZ - 1) >> OCC_SHIFT;
+    ret->oh = (h + OCC_SZ - 1) >> OCC_SHIFT;
+    SF(ret->occupied, calloc, NULL, (ret->ow*ret->oh, 1));
+    ret->pool = NULL;
+    ret->bits = NULL;
+    ret->hash = NULL;
+    ret->parking = newParking(ret);
+    ret->viewSz = 0;
+    worldKernels(ret, 1);
+    ret->viewOffsets = ret->viewDx = ret->viewDy = NULL;
 
     return ret;
 }
 
-/* build an electron loop */
-int buildLoop(World *world, int x, int y, int w, int h)
+/* draw an electron loop, without touching the cells */
+static void drawLoop(World *world, int x, int y, int w, int h)
 {
     int sx, sy;
     w += x;
@@ -86,90 +210,535 @@ int buildLoop(World *world, int x, int y, int w, int h)
     /* and the electron */
     world->c[getCell(world, x+1, y)] = CELL_ELECTRON;
     world->c[getCell(world, x, y+1)] = CELL_ELECTRON_TAIL;
+}
+
+/* build an electron loop */
+int buildLoop(World *world, int x, int y, int w, int h)
+{
+    drawLoop(world, x, y, w, h);
+    touchCell(world, x+1, y);
+    touchCell(world, x, y+1);
     return 1;
 }
 
-/* randomize a world */
-void randWorld(World *world)
+/* a counter-based random stream (SplitMix64), so that every piece of the map
+ * can have its own without them depending on each other */
+typedef struct _MapRandom MapRandom;
+struct _MapRandom {
+    uint64_t key, n;
+};
+
+static uint64_t mix64(uint64_t z)
 {
-    int w, h, tod, d, x, y, i, dx, dy;
-    w = world->w;
-    h = world->h;
-    tod = w*h/8;
-
-    x = y = dx = dy = 0;
-
-    /* first build the substrate */
-    for (d = 0; d < tod; d++) {
-        i = getCell(world, x, y);
-        if ((dx == 0 && dy == 0) || world->c[i] != CELL_NONE) {
-            world->c[i] = CELL_BASE;
-            x = random() % (w/4) * 4;
-            y = random() % (h/4) * 4;
-            dx = dy = 0;
-            while (!dx && !dy) {
-                dx = (random() % 3) - 1;
-                dy = (random() % 3) - 1;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* the next number of the stream, in [0, 2^31) like random() */
+static unsigned int mapRandom(MapRandom *r)
+{
+    return mix64(r->key + ++r->n * 0x9e3779b97f4a7c15ULL) >> 33;
+}
+
+typedef struct _MapGen MapGen;
+struct _MapGen {
+    World *world;
+    uint64_t seed;
+    int gw, gh; /* size in pieces */
+    volatile int next; /* next piece for a worker to take */
+};
+
+/* randomize the pieces of the map handed out by poolNext. Each piece is
+ * drawn only from its own stream and only within itself, so the map is the
+ * same however many workers there are */
+static void randPieces(void *mgvp, int worker, int workers)
+{
+    MapGen *mg = mgvp;
+    World *world = mg->world;
+    MapRandom r;
+    int p, x0, y0, x1, y1, pw, ph, tod, tries, d, x, y, dx, dy;
+    size_t i;
+    (void) worker;
+    (void) workers;
+
+    while ((p = poolNext(&mg->next, mg->gw * mg->gh)) >= 0) {
+        x0 = (p % mg->gw) << MAPGEN_SHIFT;
+        y0 = (p / mg->gw) << MAPGEN_SHIFT;
+        x1 = x0 + MAPGEN_SZ;
+        y1 = y0 + MAPGEN_SZ;
+        if (x1 > world->w) x1 = world->w;
+        if (y1 > world->h) y1 = world->h;
+        pw = x1 - x0;
+        ph = y1 - y0;
+        r.key = mix64(mg->seed ^ mix64(p + 1));
+        r.n = 0;
+
+        /* first the substrate, as random walks which stop when they hit
+         * something or leave the piece */
+        tod = pw*ph/8;
+        x = y = dx = dy = 0;
+        for (d = tries = 0; d < tod && tries < tod*16; d++, tries++) {
+            i = CELL_AT(world, x, y);
+            if ((dx == 0 && dy == 0) || x < x0 || x >= x1 || y < y0 || y >= y1 ||
+                world->c[i] != CELL_NONE) {
+                if (dx || dy) {
+                    if (x >= x0 && x < x1 && y >= y0 && y < y1)
+                        world->c[i] = CELL_BASE;
+                }
+                x = x0 + mapRandom(&r) % ((pw+3)/4) * 4;
+                y = y0 + mapRandom(&r) % ((ph+3)/4) * 4;
+                dx = dy = 0;
+                while (!dx && !dy) {
+                    dx = (mapRandom(&r) % 3) - 1;
+                    dy = (mapRandom(&r) % 3) - 1;
+                }
+                d--;
+                continue;
             }
-            d--;
-            continue;
+
+            /* now draw here */
+            world->c[i] = CELL_CONDUCTOR;
+
+            x += dx;
+            y += dy;
         }
 
-        /* now draw here */
-        world->c[i] = CELL_CONDUCTOR;
+        /* fix all the spots I forced not to be built */
+        for (y = y0; y < y1; y++) {
+            for (x = x0; x < x1; x++) {
+                i = CELL_AT(world, x, y);
+                if (world->c[i] == CELL_BASE)
+                    world->c[i] = CELL_NONE;
+            }
+        }
 
-        x += dx;
-        y += dy;
+        /* then the loops, one per 1024 cells on average, which must fit in
+         * the piece */
+        tod = pw*ph/1024;
+        if (mapRandom(&r) % 1024 < (unsigned int) (pw*ph%1024)) tod++;
+        for (d = 0; d < tod; d++) {
+            dx = mapRandom(&r) % 6 + 4;
+            dy = mapRandom(&r) % 6 + 4;
+            if (pw < dx + 2 || ph < dy + 2) continue;
+            x = x0 + 1 + mapRandom(&r) % (pw - dx - 1);
+            y = y0 + 1 + mapRandom(&r) % (ph - dy - 1);
+            drawLoop(world, x, y, dx, dy);
+        }
     }
+}
+
+/* randomize a world */
+void randWorld(World *world, unsigned long seed)
+{
+    MapGen mg;
+    mg.world = world;
+    mg.seed = mix64(seed);
+    mg.gw = (world->w + MAPGEN_SZ - 1) >> MAPGEN_SHIFT;
+    mg.gh = (world->h + MAPGEN_SZ - 1) >> MAPGEN_SHIFT;
+    mg.next = 0;
+    poolRun(world->pool, randPieces, &mg);
+
+    touchWorld(world);
+}
+
+/* wrap a coordinate into 0 to n-1 */
+int wrapCoord(int v, int n)
+{
+    while (v < 0) v += n;
+    while (v >= n) v -= n;
+    return v;
+}
+
+/* get a cell id at a specified location, which may be out of bounds */
+size_t getCell(World *world, int x, int y)
+{
+    x = WRAP_X(world, x);
+    y = WRAP_Y(world, y);
+    return CELL_AT(world, x, y);
+}
+
+/* get the id of the cell at (x, y), and how many follow it in memory */
+size_t cellRun(World *world, int x, int y, int *n)
+{
+    *n = world->blocked ? BLOCK_SZ - (x & (BLOCK_SZ-1)) : world->w - x;
+    return CELL_AT(world, x, y);
+}
+
+/* get the location of the cell with id i. Ids count from (0, 0), with the
+ * halo before it, so they're shifted to count from the first cell of the
+ * halo (of its block, if it's blocked) */
+int cellX(World *world, size_t i)
+{
+    size_t si = i + world->pitch + 1;
+    if (!world->blocked) return (int) (si % world->pitch) - 1;
+    return (int) (si / BLOCK_CELLS % world->bw) * BLOCK_SZ + (int) (si % BLOCK_CELLS % BLOCK_PITCH) - 1;
+}
 
-    /* fix all the spots I forced not to be built */
-    for (y = 0, dy = 0; y < h; y++, dy += w) {
-        for (x = 0, i = dy; x < w; x++, i++) {
-            if (world->c[i] == CELL_BASE)
-                world->c[i] = CELL_NONE;
+int cellY(World *world, size_t i)
+{
+    size_t si = i + world->pitch + 1;
+    if (!world->blocked) return (int) (si / world->pitch) - 1;
+    return (int) (si / BLOCK_CELLS / world->bw) * BLOCK_SZ + (int) (si % BLOCK_CELLS / BLOCK_PITCH) - 1;
+}
+
+/* per cell type, may it change, or change its neighbors, on its own? */
+static const unsigned char dynamicCells[CELL_TYPES] = {
+    0, 0, 1, 1, 1, 0, 1, 0, 0
+};
+
+/* per cell type, is its character counted up from by owner? */
+static const unsigned char ownedChars[CELL_TYPES] = {
+    0, 0, 0, 0, 0, 1, 1, 1, 1
+};
+
+/* is this a cell which may change, or change its neighbors, on its own? */
+static int isDynamic(unsigned char c)
+{
+    return dynamicCells[c];
+}
+
+/* note that the cell at this location was changed from outside of updateWorld */
+void touchCell(World *world, int x, int y)
+{
+    size_t i;
+    x = WRAP_X(world, x);
+    y = WRAP_Y(world, y);
+    i = (y>>TILE_SHIFT)*world->tw + (x>>TILE_SHIFT);
+    world->active[i] = 1;
+    world->stale[i] = 1;
+    wakeParked(world, x, y);
+}
+
+/* is this tile of these cells all blank? */
+static int blankTile(World *world, unsigned char *cells, int tx, int ty)
+{
+    static const unsigned char blank[TILE_SZ];
+    int x, xe, y, ye;
+    size_t yoff;
+    x = tx << TILE_SHIFT;
+    y = ty << TILE_SHIFT;
+    xe = x + TILE_SZ;
+    if (xe > world->w) xe = world->w;
+    ye = y + TILE_SZ;
+    if (ye > world->h) ye = world->h;
+
+    /* a tile is never split between blocks, so its rows are pitch apart */
+    for (yoff = CELL_AT(world, x, y); y < ye; y++, yoff += world->pitch) {
+        if (memcmp(cells + yoff, blank, xe - x)) return 0;
+    }
+    return 1;
+}
+
+/* note that any cell may have been changed from outside of updateWorld. Blank
+ * tiles can't change on their own, and can't be stale if they're blank in c2
+ * as well, so they're left alone and so never written */
+void touchWorld(World *world)
+{
+    int tx, ty, t;
+
+    for (ty = 0, t = 0; ty < world->th; ty++) {
+        for (tx = 0; tx < world->tw; tx++, t++) {
+            world->active[t] = !blankTile(world, world->c, tx, ty);
+            world->stale[t] = world->active[t] || !blankTile(world, world->c2, tx, ty);
         }
     }
+}
+
+static int cmpSize(const void *l, const void *r)
+{
+    size_t a = *(const size_t *) l, b = *(const size_t *) r;
+    return (a < b) ? -1 : (a > b);
+}
 
-    /* then build the loops */
-    tod = w*h/1024;
-    if (tod == 0) tod = 1;
-    for (d = 0; d < tod; d++) {
-        x = random() % w;
-        y = random() % h;
-        dx = random() % 6 + 4;
-        dy = random() % 6 + 4;
-        buildLoop(world, x, y, dx, dy);
+/* drop the cells in an owned list that are no longer owned, or are listed twice */
+static void compactOwned(World *world, unsigned char owner)
+{
+    struct Buffer_size *owned = world->owned + owner;
+    size_t i, j;
+
+    qsort(owned->buf, owned->bufused, sizeof(size_t), cmpSize);
+    for (i = j = 0; i < owned->bufused; i++) {
+        if (cellMapGet(&world->owners, owned->buf[i]) != owner) continue;
+        if (j && owned->buf[j-1] == owned->buf[i]) continue;
+        owned->buf[j++] = owned->buf[i];
     }
+    owned->bufused = j;
 }
 
-/* get a cell id at a specified location, which may be out of bounds */
-unsigned int getCell(World *world, int x, int y)
+/* get the owner of the cell at index i, which may be in a halo. A halo's
+ * cells stand in for the cells they mirror, which are what own anything */
+unsigned char cellOwner(World *world, size_t i)
+{
+    return cellMapGet(&world->owners, getCell(world, cellX(world, i), cellY(world, i)));
+}
+
+/* set the owner of the cell at index i */
+void setOwner(World *world, size_t i, unsigned char owner)
+{
+    struct Buffer_size *owned;
+    unsigned char old = cellMapGet(&world->owners, i);
+    size_t o;
+
+    if (old == owner) return;
+    cellMapSet(&world->owners, i, owner);
+    o = (cellY(world, i) >> OCC_SHIFT) * world->ow + (cellX(world, i) >> OCC_SHIFT);
+    if (old) world->occupied[o]--;
+    if (!owner) return;
+    world->occupied[o]++;
+
+    /* cells are only removed from the list lazily, when it fills up */
+    owned = world->owned + owner;
+    if (!owned->buf) INIT_BUFFER(*owned);
+    if (owned->bufused == owned->bufsz) {
+        compactOwned(world, owner);
+        if (owned->bufused > owned->bufsz / 2) EXPAND_BUFFER(*owned);
+    }
+    WRITE_ONE_BUFFER(*owned, i);
+}
+
+/* get the damage of the cell at index i */
+unsigned char cellDamage(World *world, size_t i)
+{
+    return cellMapGet(&world->damage, i);
+}
+
+/* set the damage of the cell at index i */
+void setDamage(World *world, size_t i, unsigned char damage)
 {
-    while (x < 0) x += world->w;
-    while (x >= world->w) x -= world->w;
-    while (y < 0) y += world->h;
-    while (y >= world->h) y -= world->h;
-    return y*world->w+x;
+    cellMapSet(&world->damage, i, damage);
 }
 
-/* mark a loss */
-static void markLoss(World *world, unsigned char p)
+/* get the indices of every cell owned by owner */
+struct Buffer_size *ownedCells(World *world, unsigned char owner)
+{
+    struct Buffer_size *owned = world->owned + owner;
+    if (!owned->buf) INIT_BUFFER(*owned);
+    compactOwned(world, owner);
+    return owned;
+}
+
+/* are there no owned cells within this rectangle? Checks by blocks first,
+ * unless it wraps, since the last blocks may be partial */
+static int isFree(World *world, int x, int y, int xe, int ye)
+{
+    int bx, by, xi, yi;
+
+    if (x < 0 || y < 0 || xe > world->w || ye > world->h) goto slow;
+    for (by = y >> OCC_SHIFT; by <= (ye - 1) >> OCC_SHIFT; by++) {
+        for (bx = x >> OCC_SHIFT; bx <= (xe - 1) >> OCC_SHIFT; bx++) {
+            if (world->occupied[by * world->ow + bx])
+                goto slow;
+        }
+    }
+    return 1;
+
+slow:
+    for (yi = y; yi < ye; yi++) {
+        for (xi = x; xi < xe; xi++) {
+            if (cellMapGet(&world->owners, getCell(world, xi, yi))) return 0;
+        }
+    }
+    return 1;
+}
+
+/* find a random location with no owned cells within r of it */
+void freeSpot(World *world, int r, int *x, int *y)
+{
+    unsigned int *blocks;
+    int nblocks, b, tries;
+
+    /* try the empty blocks first */
+    SF(blocks, malloc, NULL, (sizeof(unsigned int) * world->ow * world->oh));
+    for (b = nblocks = 0; b < world->ow * world->oh; b++)
+        if (!world->occupied[b]) blocks[nblocks++] = b;
+
+    for (tries = 0; nblocks && tries < 64; tries++) {
+        b = blocks[random() % nblocks];
+        *x = ((b % world->ow) << OCC_SHIFT) + random() % OCC_SZ;
+        *y = ((b / world->ow) << OCC_SHIFT) + random() % OCC_SZ;
+        if (*x >= world->w || *y >= world->h) continue;
+        if (isFree(world, *x - r, *y - r, *x + r + 1, *y + r + 1)) {
+            free(blocks);
+            return;
+        }
+    }
+    free(blocks);
+
+    /* then anywhere at all */
+    do {
+        *x = random() % world->w;
+        *y = random() % world->h;
+    } while (!isFree(world, *x - r, *y - r, *x + r + 1, *y + r + 1));
+}
+
+/* add an event at the cell at index i to a list */
+static void addEvent(World *world, struct Buffer_Event *events, int type, size_t i,
+                     unsigned char owner)
+{
+    Event ev;
+    ev.type = type;
+    ev.owner = owner;
+    ev.ts = world->ts;
+    ev.x = cellX(world, i);
+    ev.y = cellY(world, i);
+    WRITE_ONE_BUFFER(*events, ev);
+}
+
+/* add an event at the cell at index i to world->events */
+void worldEvent(World *world, int type, size_t i, unsigned char owner)
+{
+    Event ev;
+    ev.type = type;
+    ev.owner = owner;
+    ev.ts = world->ts;
+    ev.x = cellX(world, i);
+    ev.y = cellY(world, i);
+    writeEvent(world->events, &ev);
+}
+
+/* mark a loss in a zero-terminated list of LOSSES_SZ */
+void markLoss(unsigned char *losses, unsigned char p)
 {
     int i;
-    for (i = 0; world->losses[i]; i++);
-    world->losses[i] = p;
-    world->losses[i+1] = 0;
+    for (i = 0; losses[i]; i++);
+    if (i >= LOSSES_SZ - 1) return;
+    losses[i] = p;
+    losses[i+1] = 0;
 }
 
-/* update the cell in the middle of this neighborhood */
-void updateCell(World *world, int x, int y, unsigned char *c, unsigned char *owner)
+/* copy n cells, each step apart, writing only those which differ */
+static void copyHalo(unsigned char *dst, const unsigned char *src, int n, int step)
+{
+    for (; n > 0; n--, dst += step, src += step)
+        if (*dst != *src) *dst = *src;
+}
+
+/* get cell (0, 0) of the block of c at (bx, by), which may be out of bounds */
+static unsigned char *blockCells(World *world, int bx, int by)
+{
+    int bh = world->h >> BLOCK_SHIFT;
+    bx = (bx + world->bw) % world->bw;
+    by = (by + bh) % bh;
+    return world->c + ((size_t) by * world->bw + bx) * BLOCK_CELLS;
+}
+
+/* refresh the halo of the block at (bx, by) from the edges of the blocks
+ * around it */
+static void refreshBlockHalo(World *world, int bx, int by)
+{
+    const int p = BLOCK_PITCH, e = BLOCK_SZ - 1;
+    unsigned char *b = blockCells(world, bx, by);
+
+    copyHalo(b - p, blockCells(world, bx, by - 1) + e*p, BLOCK_SZ, 1);
+    copyHalo(b + BLOCK_SZ*p, blockCells(world, bx, by + 1), BLOCK_SZ, 1);
+    copyHalo(b - 1, blockCells(world, bx - 1, by) + e, BLOCK_SZ, p);
+    copyHalo(b + BLOCK_SZ, blockCells(world, bx + 1, by), BLOCK_SZ, p);
+    copyHalo(b - p - 1, blockCells(world, bx - 1, by - 1) + e*p + e, 1, 1);
+    copyHalo(b - p + BLOCK_SZ, blockCells(world, bx + 1, by - 1) + e*p, 1, 1);
+    copyHalo(b + BLOCK_SZ*p - 1, blockCells(world, bx - 1, by + 1) + e, 1, 1);
+    copyHalo(b + BLOCK_SZ*p + BLOCK_SZ, blockCells(world, bx + 1, by + 1), 1, 1);
+}
+
+/* refresh the halo of c */
+void refreshHalo(World *world)
 {
-    int *neigh;
-    unsigned char *ncs, self, sowner;
+    int y, w, h, pitch;
+    unsigned char *cells = world->c, *row;
+    w = world->w;
+    h = world->h;
+    pitch = world->pitch;
+
+    if (world->blocked) {
+        for (y = 0; y < h >> BLOCK_SHIFT; y++) {
+            for (w = 0; w < world->bw; w++)
+                refreshBlockHalo(world, w, y);
+        }
+        return;
+    }
+
+    /* first the left and right edges */
+    for (y = 0, row = cells; y < h; y++, row += pitch) {
+        row[-1] = row[w-1];
+        row[w] = row[0];
+    }
+
+    /* then the top and bottom, corners included */
+    memcpy(cells - pitch - 1, cells + (size_t) (h-1)*pitch - 1, pitch);
+    memcpy(cells + (size_t) h*pitch - 1, cells - 1, pitch);
+}
+
+/* refresh just the parts of the halo of c that the swept tiles will read:
+ * the edges of rows of tiles with either end swept, and of columns of tiles
+ * with either end swept. Cells which are already right aren't written, so
+ * that blank stretches of a big world's edges aren't allocated */
+static void refreshSweptHalo(World *world)
+{
+    int tx, ty, x, xe, y, ye, sx, w, h, tw, th, pitch, tpb, swept;
+    unsigned char *cells = world->c, *sweep = world->sweep, *row, *top, *bottom, *last;
+    w = world->w;
+    h = world->h;
+    tw = world->tw;
+    th = world->th;
+    pitch = world->pitch;
+
+    /* if it's blocked, it's the halos of the blocks with any tile swept */
+    if (world->blocked) {
+        tpb = BLOCK_SZ >> TILE_SHIFT;
+        for (y = 0; y < h >> BLOCK_SHIFT; y++) {
+            for (x = 0; x < world->bw; x++) {
+                swept = 0;
+                for (ty = y*tpb; ty < (y+1)*tpb; ty++) {
+                    for (tx = x*tpb; tx < (x+1)*tpb; tx++)
+                        swept |= sweep[ty*tw + tx];
+                }
+                if (swept) refreshBlockHalo(world, x, y);
+            }
+        }
+        return;
+    }
+
+    /* first the left and right edges, from the row above each row of tiles
+     * to the row below it */
+    for (ty = 0; ty < th; ty++) {
+        if (!sweep[ty*tw] && !sweep[ty*tw + tw - 1]) continue;
+        y = (ty << TILE_SHIFT) - 1;
+        if (y < 0) y = 0;
+        ye = ((ty + 1) << TILE_SHIFT) + 1;
+        if (ye > h) ye = h;
+        for (row = cells + (size_t) y*pitch; y < ye; y++, row += pitch) {
+            if (row[-1] != row[w-1]) row[-1] = row[w-1];
+            if (row[w] != row[0]) row[w] = row[0];
+        }
+    }
+
+    /* then the top and bottom, corners included */
+    top = cells - pitch;
+    bottom = cells + (size_t) h*pitch;
+    last = bottom - pitch;
+    for (tx = 0; tx < tw; tx++) {
+        if (!sweep[tx] && !sweep[(th-1)*tw + tx]) continue;
+        x = (tx << TILE_SHIFT) - 1;
+        xe = ((tx + 1) << TILE_SHIFT) + 1;
+        if (xe > w + 1) xe = w + 1;
+        for (; x < xe; x++) {
+            sx = (x < 0) ? w - 1 : (x >= w) ? 0 : x;
+            if (top[x] != last[sx]) top[x] = last[sx];
+            if (bottom[x] != cells[sx]) bottom[x] = cells[sx];
+        }
+    }
+}
+
+/* update the cell in the middle of this neighborhood, by index, marking any
+ * losses in losses and adding any events to events, if it isn't NULL.
+ * Returns whether its owner changed, to *owner */
+static int updateCellAt(World *world, size_t ci, unsigned char *c, unsigned char *owner,
+                        unsigned char *losses, struct Buffer_Event *events)
+{
+    size_t neigh[9];
+    unsigned char ncs[9] = {0}, self, sowner;
     int i, yi, xi;
-    i = getCell(world, x, y);
-    *c = self = world->c[i];
-    *owner = sowner = world->owner[i];
+    *c = self = world->c[ci];
 
     /* skip simple cases */
     switch (self) {
@@ -182,20 +751,17 @@ void updateCell(World *world, int x, int y, unsigned char *c, unsigned char *own
 
         case CELL_ELECTRON_TAIL:
             *c = CELL_CONDUCTOR;
-            return;
+            return 0;
 
         default:
-            return;
+            return 0;
     }
 
-    /* the rest all need a neighborhood */
-    neigh = alloca(sizeof(int)*9);
-    ncs = alloca(9);
-
+    /* the rest all need a neighborhood, which thanks to the halo is at fixed offsets */
     i = 0;
-    for (yi = y - 1; yi <= y + 1; yi++) {
-        for (xi = x - 1; xi <= x + 1; xi++, i++) {
-            neigh[i] = getCell(world, xi, yi);
+    for (yi = -world->pitch; yi <= world->pitch; yi += world->pitch) {
+        for (xi = yi - 1; xi <= yi + 1; xi++, i++) {
+            neigh[i] = ci + xi;
             ncs[i] = world->c[neigh[i]];
         }
     }
@@ -220,6 +786,7 @@ void updateCell(World *world, int x, int y, unsigned char *c, unsigned char *own
         if (flags && tails) {
             /* become a photon */
             *c = CELL_PHOTON;
+            if (events) addEvent(world, events, EVENT_PHOTON, ci, cellOwner(world, ci));
         } else {
             /* just dissipate */
             *c = CELL_ELECTRON_TAIL;
@@ -227,18 +794,21 @@ void updateCell(World *world, int x, int y, unsigned char *c, unsigned char *own
 
     } else if (self == CELL_PHOTON) {
         /* check neighborhood for flags */
-        unsigned char newOwner = 0;
+        unsigned char newOwner = 0, nowner;
         for (i = 0; i < 9; i++) {
             if (ncs[i] == CELL_FLAG || ncs[i] == CELL_FLAG_GEYSER) {
-                if (newOwner != 0 && world->owner[neigh[i]] != newOwner)
+                nowner = cellOwner(world, neigh[i]);
+                if (newOwner != 0 && nowner != newOwner)
                     break;
-                newOwner = world->owner[neigh[i]];
+                newOwner = nowner;
             }
         }
         if (i == 9 && newOwner != 0) {
             /* become a flag */
             *c = CELL_FLAG;
             *owner = newOwner;
+            if (events) addEvent(world, events, EVENT_FLAG, ci, newOwner);
+            return newOwner != cellOwner(world, ci);
         } else {
             /* just dissipate */
             *c = CELL_CONDUCTOR;
@@ -246,9 +816,12 @@ void updateCell(World *world, int x, int y, unsigned char *c, unsigned char *own
 
     } else if (self == CELL_FLAG) {
         /* check for bases in the neighborhood (for losses) */
+        sowner = cellOwner(world, ci);
         for (i = 0; i < 9; i++) {
-            if (ncs[i] == CELL_BASE && world->owner[neigh[i]] != sowner)
-                markLoss(world, sowner);
+            if (ncs[i] == CELL_BASE && cellOwner(world, neigh[i]) != sowner) {
+                markLoss(losses, sowner);
+                if (events) addEvent(world, events, EVENT_LOSS, ci, sowner);
+            }
         }
 
         /* check for photons in the neighborhood (for dissipation) */
@@ -261,71 +834,553 @@ void updateCell(World *world, int x, int y, unsigned char *c, unsigned char *own
             /* OK, we can dissipate */
             *c = CELL_CONDUCTOR;
             *owner = 0;
+            if (events) addEvent(world, events, EVENT_FLAG_DISSIPATED, ci, sowner);
+            return sowner != 0;
         }
 
     }
+
+    return 0;
 }
 
-/* update the whole world */
-void updateWorld(World *world, int iter)
+/* update the specified cell */
+void updateCell(World *world, int x, int y, unsigned char *c, unsigned char *owner)
+{
+    size_t i = getCell(world, x, y);
+    if (!updateCellAt(world, i, c, owner, world->losses, NULL))
+        *owner = cellOwner(world, i);
+}
+
+/* update the cell at index i into *c */
+int updateCellIndex(World *world, size_t i, unsigned char *c, unsigned char *owner,
+                    struct Buffer_Event *events)
 {
-    int x, y, yoff, i, w, h, wh;
-    unsigned char *tmp;
+    return updateCellAt(world, i, c, owner, world->losses, events);
+}
+
+/* update the cell at index i into c2, keeping any change of owner in owners */
+static void updateCellInto(World *world, size_t i, unsigned char *losses,
+                           struct Buffer_OwnerChange *owners, struct Buffer_Event *events)
+{
+    OwnerChange oc;
+    if (updateCellAt(world, i, world->c2 + i, &oc.owner, losses, events)) {
+        oc.cell = i;
+        WRITE_ONE_BUFFER(*owners, oc);
+    }
+}
+
+/* update the n cells from index start, which are contiguous in memory and
+ * start at column x, marking (as 2) the tiles in this row of sweep which may
+ * still change (parked loops
+ * aside, as they're replayed rather than updated), and any
+ * losses in losses. The simple Wireworld transitions are done 16 cells at a
+ * time; any cell that involves photons or flags falls back to updateCellAt,
+ * still in order. Changes of owner are added to owners, and events to events.
+ * It's always inlined, so that the copies for each pitch below have it as a
+ * constant */
+static inline __attribute__((always_inline)) void updateSpanPitch(World *world, const int pitch,
+        size_t start, int x, int n, unsigned char *sweep, unsigned char *losses,
+        struct Buffer_OwnerChange *owners, struct Buffer_Event *events)
+{
+    unsigned char *c = world->c, *c2 = world->c2;
+    size_t i = start, e = start + n;
+
+#ifdef __SSE2__
+    {
+        const __m128i one = _mm_set1_epi8(1), two = _mm_set1_epi8(2),
+            conductor = _mm_set1_epi8(CELL_CONDUCTOR),
+            electron = _mm_set1_epi8(CELL_ELECTRON),
+            tail = _mm_set1_epi8(CELL_ELECTRON_TAIL),
+            photon = _mm_set1_epi8(CELL_PHOTON),
+            flag = _mm_set1_epi8(CELL_FLAG),
+            geyser = _mm_set1_epi8(CELL_FLAG_GEYSER);
+
+        for (; i + 16 <= e; i += 16) {
+            __m128i self, electrons, flags, v, out, special;
+            int row, col, mask;
+            unsigned char *pb;
+            uint32_t parked;
+
+            /* count the electrons in each neighborhood */
+            electrons = _mm_setzero_si128();
+            for (row = -pitch; row <= pitch; row += pitch) {
+                for (col = -1; col <= 1; col++) {
+                    v = _mm_loadu_si128((__m128i *) (c + i + row + col));
+                    electrons = _mm_sub_epi8(electrons, _mm_cmpeq_epi8(v, electron));
+                }
+            }
+
+            /* and, only if there are electrons to care, look for flags */
+            self = _mm_loadu_si128((__m128i *) (c + i));
+            flags = _mm_setzero_si128();
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(self, electron))) {
+                for (row = -pitch; row <= pitch; row += pitch) {
+                    for (col = -1; col <= 1; col++) {
+                        v = _mm_loadu_si128((__m128i *) (c + i + row + col));
+                        flags = _mm_or_si128(flags, _mm_or_si128(
+                            _mm_cmpeq_epi8(v, flag), _mm_cmpeq_epi8(v, geyser)));
+                    }
+                }
+            }
+
+            /* tail -> conductor, conductor -> electron on 1 or 2, electron -> tail */
+            out = self;
+#define BLEND(mask, to) out = _mm_or_si128(_mm_and_si128((mask), (to)), _mm_andnot_si128((mask), out))
+            BLEND(_mm_cmpeq_epi8(self, tail), conductor);
+            BLEND(_mm_and_si128(_mm_cmpeq_epi8(self, conductor),
+                    _mm_or_si128(_mm_cmpeq_epi8(electrons, one), _mm_cmpeq_epi8(electrons, two))),
+                electron);
+            v = _mm_cmpeq_epi8(self, electron);
+            BLEND(v, tail);
+#undef BLEND
+            _mm_storeu_si128((__m128i *) (c2 + i), out);
+
+            /* photons, flags and electrons near flags need the full treatment */
+            special = _mm_or_si128(_mm_and_si128(v, flags), _mm_or_si128(
+                _mm_cmpeq_epi8(self, photon), _mm_cmpeq_epi8(self, flag)));
+            mask = _mm_movemask_epi8(special);
+            for (col = 0; mask >> col; col++) {
+                if ((mask >> col) & 1)
+                    updateCellInto(world, i + col, losses, owners, events);
+            }
+
+            /* photon and flag results only come from specials */
+            pb = world->parked + (i >> 3);
+            parked = (pb[0] | pb[1] << 8 | (uint32_t) pb[2] << 16) >> (i & 7);
+            if (mask || (_mm_movemask_epi8(_mm_or_si128(
+                    _mm_cmpeq_epi8(out, electron), _mm_cmpeq_epi8(out, tail))) & ~parked & 0xFFFF))
+                sweep[(x + (i - start)) >> TILE_SHIFT] = 2;
+        }
+    }
+#endif
+
+    for (; i < e; i++) {
+        updateCellInto(world, i, losses, owners, events);
+        if (isDynamic(c2[i]) && !CELL_BIT(world->parked, i))
+            sweep[(x + (i - start)) >> TILE_SHIFT] = 2;
+    }
+}
+
+/* updateSpan for any pitch */
+static void updateSpanAny(World *world, size_t start, int x, int n, unsigned char *sweep,
+                          unsigned char *losses, struct Buffer_OwnerChange *owners,
+                          struct Buffer_Event *events)
+{
+    updateSpanPitch(world, world->pitch, start, x, n, sweep, losses, owners, events);
+}
+
+/* and for a world whose pitch is P, so the neighbors are at constant offsets */
+#define UPDATE_SPAN(name, P) \
+static void name(World *world, size_t start, int x, int n, unsigned char *sweep, \
+                 unsigned char *losses, struct Buffer_OwnerChange *owners, \
+                 struct Buffer_Event *events) \
+{ \
+    updateSpanPitch(world, (P), start, x, n, sweep, losses, owners, events); \
+}
+
+UPDATE_SPAN(updateSpan256, 256 + 2)
+UPDATE_SPAN(updateSpan512, 512 + 2)
+UPDATE_SPAN(updateSpan1024, 1024 + 2)
+UPDATE_SPAN(updateSpan2048, 2048 + 2)
+UPDATE_SPAN(updateSpan4096, 4096 + 2)
+UPDATE_SPAN(updateSpan8192, 8192 + 2)
+UPDATE_SPAN(updateSpanBlocks, BLOCK_PITCH)
+
+/* figure out which tiles need to be updated: the active ones and their
+ * neighbors. They're marked 1 here, and 2 once they're found to still be active */
+static int markSweep(World *world)
+{
+    int tx, ty, sx, sy, tw, th, t, any;
+    tw = world->tw;
+    th = world->th;
+
+    memset(world->sweep, 0, tw*th);
+    any = 0;
+    for (ty = 0, t = 0; ty < th; ty++) {
+        for (tx = 0; tx < tw; tx++, t++) {
+            if (!world->active[t]) continue;
+            any = 1;
+            for (sy = ty + th - 1; sy <= ty + th + 1; sy++) {
+                for (sx = tx + tw - 1; sx <= tx + tw + 1; sx++) {
+                    world->sweep[(sy%th)*tw + (sx%tw)] = 1;
+                }
+            }
+        }
+    }
+    return any;
+}
+
+/* bring a tile of c2 up to date with c */
+static void syncTile(World *world, int tx, int ty)
+{
+    int x, y, xe, ye;
+    size_t yoff;
+    x = tx << TILE_SHIFT;
+    y = ty << TILE_SHIFT;
+    xe = x + TILE_SZ;
+    if (xe > world->w) xe = world->w;
+    ye = y + TILE_SZ;
+    if (ye > world->h) ye = world->h;
+
+    for (yoff = CELL_AT(world, x, y); y < ye; y++, yoff += world->pitch) {
+        memcpy(world->c2 + yoff, world->c + yoff, xe - x);
+    }
+}
+
+/* update every swept tile in the rows of tiles handed out by poolNext into c2,
+ * each row of tiles into its own lists of losses, owner changes and events */
+static void updateTileRows(void *worldvp, int worker, int workers)
+{
+    World *world = worldvp;
+    int x, xe, y, ye, w, n, tx, ty, tw;
+    size_t i;
+    unsigned char *sweep, *losses;
+    struct Buffer_OwnerChange *owners;
+    struct Buffer_Event *events;
+    (void) worker;
+    (void) workers;
     w = world->w;
-    h = world->h;
-    wh = w * h;
+    tw = world->tw;
 
-    while (iter--) {
-        memcpy(world->c2, world->c, wh);
-        memcpy(world->o2, world->owner, wh);
-        for (y = 0, yoff = 0; y < h; y++, yoff += w) {
-            for (x = 0, i = yoff; x < w; x++, i++) {
-                updateCell(world, x, y, world->c2 + i, world->o2 + i);
+    while ((ty = poolNext(&world->nextTileRow, world->th)) >= 0) {
+        sweep = world->sweep + ty*tw;
+        losses = world->tileLosses + ty*LOSSES_SZ;
+        losses[0] = 0;
+        owners = world->tileOwners + ty;
+        owners->bufused = 0;
+        events = NULL;
+        if (world->events) {
+            events = world->tileEvents + ty;
+            events->bufused = 0;
+        }
+        if (!memchr(sweep, 1, tw)) continue;
+
+        y = ty << TILE_SHIFT;
+        ye = y + TILE_SZ;
+        if (ye > world->h) ye = world->h;
+        for (; y < ye; y++) {
+            /* each run of swept tiles is one span, or one per block */
+            for (tx = 0; tx < tw; tx++) {
+                if (!sweep[tx]) continue;
+                x = tx << TILE_SHIFT;
+                while (tx < tw && sweep[tx]) tx++;
+                xe = tx << TILE_SHIFT;
+                if (xe > w) xe = w;
+                for (; x < xe; x += n) {
+                    i = cellRun(world, x, y, &n);
+                    if (n > xe - x) n = xe - x;
+                    world->updateSpan(world, i, x, n, sweep, losses, owners, events);
+                }
+            }
+        }
+    }
+}
+
+/* get the tiles in the rows handed out by poolNext ready for c and c2 to be
+ * swapped, and keep active whichever still have changing cells. Swept tiles
+ * are only up to date in c2 and the rest only in c, so the latter may need
+ * copying, but only once after each time they're swept */
+static void commitTileRows(void *worldvp, int worker, int workers)
+{
+    World *world = worldvp;
+    int tx, ty, i;
+    (void) worker;
+    (void) workers;
+
+    while ((ty = poolNext(&world->nextTileRow, world->th)) >= 0) {
+        for (tx = 0, i = ty*world->tw; tx < world->tw; tx++, i++) {
+            if (world->sweep[i]) {
+                world->stale[i] = 1;
+            } else if (world->stale[i]) {
+                syncTile(world, tx, ty);
+                world->stale[i] = 0;
             }
+            world->active[i] = (world->sweep[i] == 2);
+        }
+    }
+}
+
+/* update the tiles marked by markSweep */
+static void updateSwept(World *world)
+{
+    int ty;
+    size_t oi;
+    unsigned char *l;
+    struct Buffer_OwnerChange *owners;
+    struct Buffer_Event *events;
+
+    refreshSweptHalo(world);
+
+    /* update the swept tiles into c2 */
+    world->nextTileRow = 0;
+    poolRun(world->pool, updateTileRows, world);
+
+    /* gather the losses in row-major order, same as a sweep of the whole world */
+    for (ty = 0; ty < world->th; ty++) {
+        for (l = world->tileLosses + ty*LOSSES_SZ; *l; l++)
+            markLoss(world->losses, *l);
+    }
+
+    /* and the events, likewise */
+    if (world->events) {
+        for (ty = 0; ty < world->th; ty++) {
+            events = world->tileEvents + ty;
+            for (oi = 0; oi < events->bufused; oi++)
+                writeEvent(world->events, events->buf + oi);
+        }
+    }
+
+    /* owners are only changed by photons and flags, so just patch them */
+    for (ty = 0; ty < world->th; ty++) {
+        owners = world->tileOwners + ty;
+        for (oi = 0; oi < owners->bufused; oi++)
+            setOwner(world, owners->buf[oi].cell, owners->buf[oi].owner);
+    }
+
+    /* then swap in the new cells */
+    world->nextTileRow = 0;
+    poolRun(world->pool, commitTileRows, world);
+    l = world->c;
+    world->c = world->c2;
+    world->c2 = l;
+}
+
+/* the reference engine: every cell of every tick with updateCell */
+static void updateWorldReference(World *world, int iter)
+{
+    struct Buffer_OwnerChange owners;
+    struct Buffer_Event events;
+    unsigned char *l;
+    size_t oi;
+    int x, y;
+
+    INIT_BUFFER(owners);
+    INIT_BUFFER(events);
+
+    while (iter--) {
+        world->ts++;
+        refreshHalo(world);
+        owners.bufused = events.bufused = 0;
+
+        for (y = 0; y < world->h; y++) {
+            for (x = 0; x < world->w; x++)
+                updateCellInto(world, CELL_AT(world, x, y), world->losses, &owners,
+                               world->events ? &events : NULL);
         }
 
-        /* swap buffers */
-        tmp = world->c;
+        for (oi = 0; oi < events.bufused; oi++)
+            writeEvent(world->events, events.buf + oi);
+        for (oi = 0; oi < owners.bufused; oi++)
+            setOwner(world, owners.buf[oi].cell, owners.buf[oi].owner);
+        l = world->c;
         world->c = world->c2;
-        world->c2 = tmp;
+        world->c2 = l;
+    }
 
-        tmp = world->owner;
-        world->owner = world->o2;
-        world->o2 = tmp;
+    /* none of the tiles' bookkeeping is right any more */
+    touchWorld(world);
+
+    FREE_BUFFER(owners);
+    FREE_BUFFER(events);
+}
 
+/* the tiled engine: only the tiles which may change, and loops which have
+ * been found to cycle are replayed instead of updated */
+static void updateWorldTiled(World *world, int iter)
+{
+    while (iter--) {
         world->ts++;
+        if (markSweep(world)) updateSwept(world);
+        stepParked(world);
+        if (++world->parking->sinceSearch >= PARK_INTERVAL) parkWorld(world);
+    }
+}
+
+/* the fast engine: the tiled engine, but with runs of many ticks done as
+ * bitboards, or by hashlife */
+static void updateWorldFast(World *world, int iter)
+{
+    int ran, fast;
+
+    /* the fast-forwards index cells with unsigned ints, so they're only for
+     * worlds of up to 4G cells */
+    fast = ((size_t) world->w * world->h <= UINT_MAX);
+
+    if (fast && iter >= HASHLIFE_MIN_ITER) {
+        ran = updateWorldHash(world, iter);
+        skipParked(world, ran);
+        iter -= ran;
     }
+    if (fast && iter >= BITBOARD_MIN_ITER) {
+        updateWorldBits(world, iter);
+        skipParked(world, iter);
+        return;
+    }
+
+    updateWorldTiled(world, iter);
+}
+
+const Engine engines[] = {
+    {"fast", updateWorldFast},
+    {"tiled", updateWorldTiled},
+    {"reference", updateWorldReference},
+    {NULL, NULL}
+};
+
+/* find an engine by name */
+const Engine *findEngine(const char *name)
+{
+    const Engine *engine;
+    for (engine = engines; engine->name; engine++)
+        if (!strcmp(engine->name, name)) return engine;
+    return NULL;
+}
+
+/* update the whole world, with its engine */
+void updateWorld(World *world, int iter)
+{
+    world->engine->update(world, iter);
 }
 
 /* generate a viewport char for this location */
-static unsigned char viewportChar(World *world, int i)
+static unsigned char viewportChar(World *world, size_t i)
 {
-    char ret = world->c[i];
-    if (ret == CELL_AGENT || ret == CELL_FLAG || ret == CELL_FLAG_GEYSER || ret == CELL_BASE)
-        ret += world->owner[i] - 1;
+    unsigned char c = world->c[i];
+    char ret = CELL_CHARS[c];
+    if (ownedChars[c]) ret += cellMapGet(&world->owners, i) - 1;
     return ret;
 }
 
-/* generate a viewport from this location and cardinality */
-void viewport(unsigned char *c, unsigned char *damage, World *world, int x, int y, int cardinality, int sz)
+/* build the viewport offset tables of world for this size */
+static void viewportTables(World *world, int sz)
 {
     CardinalityHelper ch;
-    int sx, sy, hsz, i, cell;
+    int sq = sz*sz, card, sx, sy, hsz = sz/2, i, dx, dy;
+
+    free(world->viewOffsets);
+    SF(world->viewOffsets, malloc, NULL, (sizeof(int) * 3 * CARDINALITIES * sq));
+    world->viewDx = world->viewOffsets + CARDINALITIES * sq;
+    world->viewDy = world->viewDx + CARDINALITIES * sq;
+    world->viewSz = sz;
 
-    hsz = sz/2;
+    for (card = 0; card < CARDINALITIES; card++) {
+        /* crazy math time */
+        ch = cardinalityHelpers[card];
+        i = card * sq;
+        for (sy = -sz + 1; sy <= 0; sy++) {
+            for (sx = -hsz; sx <= hsz; sx++, i++) {
+                dx = ch.xr*sx + ch.xd*sy;
+                dy = ch.yr*sx + ch.yd*sy;
+                world->viewOffsets[i] = dy*world->pitch + dx;
+                world->viewDx[i] = dx;
+                world->viewDy[i] = dy;
+            }
+        }
+    }
+}
 
-    /* crazy math time */
-    ch = cardinalityHelpers[cardinality];
+/* a viewport, for any size of world */
+static void viewportAny(unsigned char *c, unsigned char *damage, World *world,
+                        int x, int y, int cardinality, int sz)
+{
+    int sq = sz*sz, reach = sz - 1, i, *off, *dx, *dy;
+    size_t cell, base;
 
-    /* now loop over the whole area */
-    i = 0;
-    for (sy = -sz + 1; sy <= 0; sy++) {
-        for (sx = -hsz; sx <= hsz; sx++, i++) {
-            cell = getCell(world,
-                x + ch.xr*sx + ch.xd*sy,
-                y + ch.yr*sx + ch.yd*sy);
+    if (x < reach || x + reach >= world->w || y < reach || y + reach >= world->h ||
+        (world->blocked && (((x - reach) ^ (x + reach)) >> BLOCK_SHIFT ||
+                            ((y - reach) ^ (y + reach)) >> BLOCK_SHIFT))) {
+        /* it wraps (or leaves its block), so each cell has to be found */
+        dx = world->viewDx + cardinality * sq;
+        dy = world->viewDy + cardinality * sq;
+        for (i = 0; i < sq; i++) {
+            cell = getCell(world, x + dx[i], y + dy[i]);
             c[i] = viewportChar(world, cell);
-            damage[i] = world->damage[cell];
+            damage[i] = cellMapGet(&world->damage, cell);
         }
+        return;
+    }
+
+    /* it doesn't, so every cell is at a fixed offset */
+    off = world->viewOffsets + cardinality * sq;
+    base = CELL_AT(world, x, y);
+    for (i = 0; i < sq; i++) {
+        cell = base + off[i];
+        c[i] = viewportChar(world, cell);
+        damage[i] = cellMapGet(&world->damage, cell);
+    }
+}
+
+/* and for a world W wide in rows, W a power of two, where wrapping is
+ * masking and the pitch is a constant */
+#define VIEWPORT(W) \
+static void viewport##W(unsigned char *c, unsigned char *damage, World *world, \
+                        int x, int y, int cardinality, int sz) \
+{ \
+    int sq = sz*sz, reach = sz - 1, hmask = world->h - 1, i, *off, *dx, *dy; \
+    size_t cell, base; \
+    \
+    if (x < reach || x + reach >= (W) || y < reach || y + reach >= world->h) { \
+        dx = world->viewDx + cardinality * sq; \
+        dy = world->viewDy + cardinality * sq; \
+        for (i = 0; i < sq; i++) { \
+            cell = (size_t) ((y + dy[i]) & hmask) * ((W) + 2) + ((x + dx[i]) & ((W) - 1)); \
+            c[i] = viewportChar(world, cell); \
+            damage[i] = cellMapGet(&world->damage, cell); \
+        } \
+        return; \
+    } \
+    \
+    off = world->viewOffsets + cardinality * sq; \
+    base = (size_t) y * ((W) + 2) + x; \
+    for (i = 0; i < sq; i++) { \
+        cell = base + off[i]; \
+        c[i] = viewportChar(world, cell); \
+        damage[i] = cellMapGet(&world->damage, cell); \
+    } \
+}
+
+VIEWPORT(256)
+VIEWPORT(512)
+VIEWPORT(1024)
+VIEWPORT(2048)
+VIEWPORT(4096)
+VIEWPORT(8192)
+
+static const struct {
+    int w;
+    void (*updateSpan)(World *, size_t, int, int, unsigned char *, unsigned char *,
+                       struct Buffer_OwnerChange *, struct Buffer_Event *);
+    void (*viewport)(unsigned char *, unsigned char *, World *, int, int, int, int);
+} kernels[] = {
+    {256, updateSpan256, viewport256},
+    {512, updateSpan512, viewport512},
+    {1024, updateSpan1024, viewport1024},
+    {2048, updateSpan2048, viewport2048},
+    {4096, updateSpan4096, viewport4096},
+    {8192, updateSpan8192, viewport8192},
+    {0, updateSpanAny, viewportAny}
+};
+
+/* pick the kernels for the world's size. A blocked world of any size gets
+ * the update compiled for the pitch of blocks */
+void worldKernels(World *world, int specialize)
+{
+    int k;
+
+    world->pow2 = specialize && !(world->w & (world->w - 1)) && !(world->h & (world->h - 1));
+    for (k = 0; kernels[k].w && !(world->pow2 && !world->blocked && kernels[k].w == world->w); k++);
+    world->updateSpan = kernels[k].updateSpan;
+    world->viewportKernel = kernels[k].viewport;
+    world->kernelW = kernels[k].w;
+    if (specialize && world->blocked) {
+        world->updateSpan = updateSpanBlocks;
+        world->kernelW = BLOCK_SZ;
     }
 }
+
+/* generate a viewport from this location and cardinality */
+void viewport(unsigned char *c, unsigned char *damage, World *world, int x, int y, int cardinality, int sz)
+{
+    if (world->viewSz != sz) viewportTables(world, sz);
+    world->viewportKernel(c, damage, world, x, y, cardinality, sz);
+}
@@ -17,27 +17,154 @@
 #ifndef CA_H
 #define CA_H
 
+#include <stdlib.h>
+
+#include "buffer.h"
+#include "cellmap.h"
+#include "event.h"
+
 typedef struct _World World;
+typedef struct _OwnerChange OwnerChange;
+typedef struct _Engine Engine;
+
+/* the world is split into tiles of TILE_SZ x TILE_SZ cells, and only tiles
+ * which are active (or border an active tile) are updated */
+#define TILE_SHIFT 5
+#define TILE_SZ (1<<TILE_SHIFT)
+
+/* a world may be stored in blocks of BLOCK_SZ x BLOCK_SZ cells rather than in
+ * rows, so that a cell's neighborhood, a tile or a viewport falls in a few
+ * nearby cache lines rather than one per row */
+#define BLOCK_SHIFT 6
+#define BLOCK_SZ (1<<BLOCK_SHIFT)
+#define BLOCK_PITCH (BLOCK_SZ+2)
+#define BLOCK_CELLS (BLOCK_PITCH*BLOCK_PITCH)
+
+/* owned cells are counted per block of OCC_SZ x OCC_SZ cells */
+#define OCC_SHIFT 3
+#define OCC_SZ (1<<OCC_SHIFT)
+
+/* size of a (zero-terminated) list of losses */
+#define LOSSES_SZ 256
 
+/* a change of owner made by an update, to apply once the update is done */
+struct _OwnerChange {
+    size_t cell;
+    unsigned char owner;
+};
+
+BUFFER(OwnerChange, OwnerChange);
+BUFFER(size, size_t);
+
+/* a bit per cell, for per-cell flags */
+#define CELL_BIT(bits, i) ((bits)[(i) >> 3] & (1 << ((i) & 7)))
+#define SET_CELL_BIT(bits, i) ((bits)[(i) >> 3] |= (1 << ((i) & 7)))
+#define CLEAR_CELL_BIT(bits, i) ((bits)[(i) >> 3] &= ~(1 << ((i) & 7)))
+
+/* c is surrounded by a one-cell halo, which mirrors the opposite edge of the
+ * (toroidal) world, so cell (x, y) is at y*pitch+x and its neighbors are
+ * always at fixed offsets from it. A blocked world is instead stored block
+ * after block, each its own BLOCK_PITCH x BLOCK_PITCH grid with a halo
+ * mirroring the blocks around it, and pitch is BLOCK_PITCH (see CELL_AT).
+ * Other per-cell state is indexed the same way, but has no halo */
 struct _World {
+    const Engine *engine; /* how it's updated */
     unsigned char ts;
-    unsigned char losses[256];
-    int w, h;
-    unsigned char *c, *c2, *owner, *o2, *damage;
+    unsigned char losses[LOSSES_SZ];
+    int w, h, pitch;
+    int pow2; /* are w and h powers of two, so coordinates wrap by masking? */
+    int blocked; /* is it stored in blocks? */
+    int bw; /* if so, how many blocks wide it is, or else 1 */
+    size_t csz; /* the size of c and c2, halos and all */
+    unsigned char *c;
+    unsigned char *c2; /* the back buffer for c, swapped with it each tick */
+    unsigned char *parked; /* bits per cell, is it part of a parked loop? */
+
+    /* only agents, flags, geysers and bases have owners, and only hit cells
+     * have damage, so they're kept sparsely. See cellOwner and cellDamage */
+    CellMap owners, damage;
+
+    int tw, th; /* size in tiles */
+    unsigned char *active; /* per tile, does it contain anything that may change? */
+    unsigned char *sweep; /* per tile, is it being updated this tick? */
+    unsigned char *stale; /* per tile, may c2 differ from c? */
+
+    struct _Pool *pool; /* workers to update with, or NULL to do it alone */
+    volatile int nextTileRow; /* next row of tiles for a worker to take */
+    unsigned char *tileLosses; /* per row of tiles, losses marked by its worker */
+    struct Buffer_OwnerChange *tileOwners; /* and owner changes */
+    struct Buffer_Event *tileEvents; /* and events */
+
+    EventRing *events; /* events of the updates, or NULL if nobody's listening */
+
+    /* per owner, cells which have been given to it (and may since have been
+     * taken away), and per block, how many cells are owned at all. Both are
+     * kept by setOwner */
+    struct Buffer_size owned[256];
+    int ow, oh;
+    unsigned char *occupied;
+
+    /* for fast-forwarding, allocated when first needed */
+    struct _Bitboard *bits;
+    struct _HashLife *hash;
+
+    struct _Parking *parking; /* loops which are replayed instead of updated */
+
+    /* per cardinality, the offsets of the cells of a viewport of viewSz
+     * from its center, as cell indices and as x and y */
+    int viewSz;
+    int *viewOffsets, *viewDx, *viewDy;
+
+    /* the update of a span of a row and the viewport, and the width they
+     * were compiled for (BLOCK_SZ if it's blocked, or 0 if they're generic) */
+    void (*updateSpan)(World *world, size_t start, int x, int n, unsigned char *sweep,
+                       unsigned char *losses, struct Buffer_OwnerChange *owners,
+                       struct Buffer_Event *events);
+    void (*viewportKernel)(unsigned char *c, unsigned char *damage, World *world,
+                           int x, int y, int cardinality, int sz);
+    int kernelW;
+};
+
+/* wrap a coordinate, which may be out of bounds, into the world */
+#define WRAP_X(world, x) ((world)->pow2 ? (x) & ((world)->w - 1) : wrapCoord((x), (world)->w))
+#define WRAP_Y(world, y) ((world)->pow2 ? (y) & ((world)->h - 1) : wrapCoord((y), (world)->h))
+
+/* the index of the cell at (x, y), which must be in bounds */
+#define CELL_AT(world, x, y) ((world)->blocked ? \
+    ((size_t) ((y) >> BLOCK_SHIFT) * (world)->bw + ((x) >> BLOCK_SHIFT)) * BLOCK_CELLS + \
+        ((y) & (BLOCK_SZ-1)) * BLOCK_PITCH + ((x) & (BLOCK_SZ-1)) : \
+    (size_t) (y) * (world)->pitch + (x))
+
+/* a way of updating the world. Every engine must give the same cells,
+ * owners, losses and events as the reference engine, which updates every
+ * cell with updateCell */
+struct _Engine {
+    const char *name;
+    void (*update)(World *world, int iter);
 };
 
+/* the engines, ending with one with no name. The first is the default */
+extern const Engine engines[];
+
+/* cells are stored as these, which are dense so that they can index small
+ * tables. Agents see them as CELL_CHARS (see README.agents) */
 enum CellTypes {
-    CELL_NONE = ' ',
-    CELL_CONDUCTOR = '.',
-    CELL_ELECTRON = '*',
-    CELL_ELECTRON_TAIL = ',',
-    CELL_PHOTON = '~',
-    CELL_AGENT = '0',
-    CELL_FLAG = 'A',
-    CELL_FLAG_GEYSER = 'a',
-    CELL_BASE = 'n'
+    CELL_NONE,
+    CELL_CONDUCTOR,
+    CELL_ELECTRON,
+    CELL_ELECTRON_TAIL,
+    CELL_PHOTON,
+    CELL_AGENT,
+    CELL_FLAG,
+    CELL_FLAG_GEYSER,
+    CELL_BASE,
+    CELL_TYPES
 };
 
+/* the character of each cell type. Agents, flags, geysers and bases count up
+ * from theirs by owner */
+#define CELL_CHARS " .*,~0Aan"
+
 enum Cardinality {
     NORTH, EAST, SOUTH, WEST, CARDINALITIES
 };
@@ -50,19 +177,90 @@ struct _CardinalityHelper {
 
 extern const CardinalityHelper cardinalityHelpers[];
 
-/* allocate a world */
-World *newWorld(int w, int h);
+/* allocate a world, in blocks if blocked is set and its sides are multiples
+ * of BLOCK_SZ, or else in rows */
+World *newWorld(int w, int h, int blocked);
+
+/* allocate a world around existing cells, each pointing at (0, 0) of an
+ * array of csz with its halo, or NULL to allocate blank ones. c2 must be a
+ * copy of c */
+World *newWorldFrom(int w, int h, int blocked, unsigned char *c, unsigned char *c2);
+
+/* allocate bits per cell, all clear */
+unsigned char *newCellBits(World *world);
+
+/* expect a new world to stay mostly blank, so that its cells are only
+ * allocated where something's written, a small page at a time */
+void sparseWorld(World *world);
 
-/* randomize a world */
-void randWorld(World *world);
+/* randomize a world, the same way for the same seed */
+void randWorld(World *world, unsigned long seed);
+
+/* pick the kernels for the world's size: ones compiled for it if it's a
+ * common power of two stored in rows (or for blocks, if it's blocked) and
+ * specialize is set, or else the generic ones */
+void worldKernels(World *world, int specialize);
+
+/* wrap a coordinate into 0 to n-1, the slow way (see WRAP_X and WRAP_Y) */
+int wrapCoord(int v, int n);
 
 /* get a cell id at a specified location, which may be out of bounds */
-unsigned int getCell(World *world, int x, int y);
+size_t getCell(World *world, int x, int y);
+
+/* get the id of the cell at (x, y), which must be in bounds, and in *n how
+ * many cells of its row from there on follow it in memory */
+size_t cellRun(World *world, int x, int y, int *n);
+
+/* get the location of the cell with id i. A cell of a halo is where the cell
+ * it mirrors would be, which may be out of bounds */
+int cellX(World *world, size_t i);
+int cellY(World *world, size_t i);
+
+/* note that the cell at this location was changed from outside of
+ * updateWorld, so that nearby tiles and parked loops get updated */
+void touchCell(World *world, int x, int y);
 
-/* update the specified cell */
+/* note that any cell may have been changed from outside of updateWorld */
+void touchWorld(World *world);
+
+/* add an event at the cell at index i to world->events, which must exist */
+void worldEvent(World *world, int type, size_t i, unsigned char owner);
+
+/* get the owner of the cell at index i, which may be in the halo */
+unsigned char cellOwner(World *world, size_t i);
+
+/* set the owner of the cell at index i */
+void setOwner(World *world, size_t i, unsigned char owner);
+
+/* get and set the damage of the cell at index i */
+unsigned char cellDamage(World *world, size_t i);
+void setDamage(World *world, size_t i, unsigned char damage);
+
+/* get the indices of every cell owned by owner */
+struct Buffer_size *ownedCells(World *world, unsigned char owner);
+
+/* find a random location with no owned cells within r of it */
+void freeSpot(World *world, int r, int *x, int *y);
+
+/* mark a loss in a zero-terminated list of LOSSES_SZ */
+void markLoss(unsigned char *losses, unsigned char p);
+
+/* refresh the halo of c, or of every block of it. updateWorld does this once
+ * per tick */
+void refreshHalo(World *world);
+
+/* update the specified cell (the halo must be current) */
 void updateCell(World *world, int x, int y, unsigned char *c, unsigned char *owner);
 
-/* update the whole world */
+/* update the cell at index i into *c, the same way, adding any events to
+ * events if it isn't NULL. Returns whether its owner changed, to *owner */
+int updateCellIndex(World *world, size_t i, unsigned char *c, unsigned char *owner,
+                    struct Buffer_Event *events);
+
+/* find an engine by name, or NULL */
+const Engine *findEngine(const char *name);
+
+/* update the whole world, with its engine */
 void updateWorld(World *world, int iter);
 
 /* generate a viewport from this location and cardinality */
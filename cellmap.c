@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cellmap.h"
+#include "helpers.h"
+
+#define CELLMAP_MIN_SIZE 64
+
+/* where a cell's probe starts */
+#define HASH(map, cell) (((cell) * 0x9E3779B97F4A7C15ULL) >> 32 & ((map)->size - 1))
+
+static void allocCellMap(CellMap *map, size_t size)
+{
+    size_t i;
+    map->size = size;
+    map->used = 0;
+    SF(map->cells, malloc, NULL, (sizeof(size_t) * size));
+    SF(map->vals, malloc, NULL, (size));
+    for (i = 0; i < size; i++) map->cells[i] = CELLMAP_EMPTY;
+}
+
+/* initialize an empty cell map */
+void initCellMap(CellMap *map)
+{
+    allocCellMap(map, CELLMAP_MIN_SIZE);
+}
+
+/* get the value of a cell */
+unsigned char cellMapGet(CellMap *map, size_t cell)
+{
+    size_t i, mask = map->size - 1;
+    if (!map->used) return 0;
+    for (i = HASH(map, cell); map->cells[i] != CELLMAP_EMPTY; i = (i + 1) & mask)
+        if (map->cells[i] == cell) return map->vals[i];
+    return 0;
+}
+
+/* keep it at most half full */
+static void growCellMap(CellMap *map)
+{
+    size_t *cells = map->cells, size = map->size, i;
+    unsigned char *vals = map->vals;
+
+    allocCellMap(map, size * 2);
+    for (i = 0; i < size; i++)
+        if (cells[i] != CELLMAP_EMPTY) cellMapSet(map, cells[i], vals[i]);
+    free(cells);
+    free(vals);
+}
+
+/* set the value of a cell */
+void cellMapSet(CellMap *map, size_t cell, unsigned char val)
+{
+    size_t i, j, k, mask = map->size - 1;
+
+    for (i = HASH(map, cell); map->cells[i] != CELLMAP_EMPTY; i = (i + 1) & mask)
+        if (map->cells[i] == cell) break;
+
+    if (map->cells[i] == CELLMAP_EMPTY) {
+        if (!val) return;
+        map->cells[i] = cell;
+        map->vals[i] = val;
+        if (++map->used * 2 > map->size) growCellMap(map);
+        return;
+    }
+
+    if (val) {
+        map->vals[i] = val;
+        return;
+    }
+
+    /* remove it, moving back anything later in its run which could have been
+     * placed in its slot */
+    map->used--;
+    for (j = (i + 1) & mask; map->cells[j] != CELLMAP_EMPTY; j = (j + 1) & mask) {
+        k = HASH(map, map->cells[j]);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            map->cells[i] = map->cells[j];
+            map->vals[i] = map->vals[j];
+            i = j;
+        }
+    }
+    map->cells[i] = CELLMAP_EMPTY;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#ifndef CELLMAP_H
+#define CELLMAP_H
+
+#include <stdlib.h>
+
+typedef struct _CellMap CellMap;
+
+/* a byte per cell for things which are zero for nearly every cell (owners
+ * and damage), as a hash table of the cells which aren't, with linear
+ * probing. Nothing is stored for zero */
+struct _CellMap {
+    size_t *cells; /* CELLMAP_EMPTY where there's nothing */
+    unsigned char *vals;
+    size_t size; /* a power of two */
+    size_t used;
+};
+
+#define CELLMAP_EMPTY ((size_t) -1)
+
+/* initialize an empty cell map */
+void initCellMap(CellMap *map);
+
+/* get the value of a cell */
+unsigned char cellMapGet(CellMap *map, size_t cell);
+
+/* set the value of a cell, 0 to remove it */
+void cellMapSet(CellMap *map, size_t cell, unsigned char val);
+
+#endif
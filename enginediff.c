@@ -0,0 +1,518 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+
+#define _BSD_SOURCE /* for random */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "agent.h"
+#include "ca.h"
+#include "helpers.h"
+#include "pool.h"
+#include "snapshot.h"
+
+/* the kinds of world we step */
+enum DiffKinds {
+    KIND_RANDOM, KIND_SOUP, KIND_FLAGS, KIND_RACES, KINDS
+};
+
+static const char *kindNames[] = {"random", "soup", "flags", "races"};
+
+static char help_text[] =
+    "Usage: rezzo-diff [options]\n"
+    "Steps worlds through two engines in lockstep, and reports the first cell\n"
+    "or event where they differ.\n"
+    "Options:\n"
+    "\t-a <engine>  The first engine (default reference)\n"
+    "\t-b <engine>  The second engine (default fast)\n"
+    "\t-k <kind>    Only this kind of world (random, soup, flags or races)\n"
+    "\t-w N, -h N   Set world size\n"
+    "\t-r N         Set the first seed\n"
+    "\t-n N         Step N seeds of each kind\n"
+    "\t-t N         Step each world for N steps\n"
+    "\t-i N         Update by N ticks per step, comparing after each\n"
+    "\t-g N         Put N agents in each world, acting at random\n"
+    "\t-j N         Update the worlds with N threads\n"
+    "\t-B           Lay the second engine's worlds out in 64x64 blocks\n"
+    "\t-s N         Snapshot the second world after N steps, and carry on\n"
+    "\t             from the snapshot\n"
+    "With -i 1, the first engine's events are also checked against its cells.\n";
+
+/* a little random generator of our own, so both worlds get the same draws */
+static unsigned long diffRandom(unsigned long *state)
+{
+    *state = *state * 6364136223846793005UL + 1442695040888963407UL;
+    return *state >> 33;
+}
+
+/* a random owner, sometimes of an agent and sometimes not */
+static unsigned char diffOwner(unsigned long *r, int agents)
+{
+    return 1 + diffRandom(r) % (agents + 1);
+}
+
+/* fill the blank, unowned cells with a soup of every kind of cell, in
+ * proportions out of 100 */
+static void soup(World *world, unsigned long *r, int agents, const int *weights)
+{
+    static const unsigned char types[] = {
+        CELL_CONDUCTOR, CELL_ELECTRON, CELL_ELECTRON_TAIL, CELL_PHOTON,
+        CELL_FLAG, CELL_FLAG_GEYSER, CELL_BASE
+    };
+    size_t i;
+    int x, y, t, p;
+
+    for (y = 0; y < world->h; y++) {
+        for (x = 0; x < world->w; x++) {
+            i = getCell(world, x, y);
+            if (world->c[i] != CELL_NONE || cellOwner(world, i)) continue;
+            p = diffRandom(r) % 100;
+            for (t = 0; t < (int) sizeof(types) && p >= weights[t]; p -= weights[t++]);
+            if (t == sizeof(types)) continue;
+            world->c[i] = types[t];
+            if (types[t] >= CELL_FLAG) setOwner(world, i, diffOwner(r, agents));
+        }
+    }
+}
+
+/* wires carrying electrons past geysers of different owners, so that photons
+ * race to become flags of one owner or the other */
+static void races(World *world, unsigned long *r, int agents)
+{
+    size_t i;
+    int x, y, bx, by, len, g;
+
+    for (by = 0; by + 8 <= world->h; by += 8) {
+        for (bx = 0; bx + 8 <= world->w; bx += 8) {
+            if (world->c[getCell(world, bx, by)] != CELL_NONE) continue;
+            y = by + 3;
+            len = 4 + diffRandom(r) % 4;
+            for (x = bx; x < bx + len; x++)
+                world->c[getCell(world, x, y)] = CELL_CONDUCTOR;
+            world->c[getCell(world, bx + 1, y)] = CELL_ELECTRON;
+            world->c[getCell(world, bx, y)] = CELL_ELECTRON_TAIL;
+
+            /* geysers on either side, usually of different owners */
+            for (g = 0; g < 2; g++) {
+                i = getCell(world, bx + 2 + diffRandom(r) % (len - 2), y + (g ? 1 : -1));
+                world->c[i] = CELL_FLAG_GEYSER;
+                setOwner(world, i, diffOwner(r, agents));
+            }
+
+            /* and now and then a base to lose to */
+            if (diffRandom(r) % 4 == 0) {
+                i = getCell(world, bx + diffRandom(r) % 8, y + 2);
+                if (world->c[i] == CELL_NONE) {
+                    world->c[i] = CELL_BASE;
+                    setOwner(world, i, diffOwner(r, agents));
+                }
+            }
+        }
+    }
+}
+
+/* make a world of this kind, with its agents */
+static AgentList *diffWorld(int kind, unsigned long seed, int w, int h, int blocked,
+                            int agents, const Engine *engine, struct _Pool *pool)
+{
+    static const int soupWeights[] = {20, 6, 4, 4, 6, 2, 4};
+    static const int flagWeights[] = {25, 10, 6, 6, 12, 4, 8};
+    World *world = newWorld(w, h, blocked);
+    AgentList *list;
+    unsigned long r = seed;
+    int a;
+
+    world->engine = engine;
+    world->pool = pool;
+    world->events = newEventRing(EVENT_RING_SZ);
+    if (kind == KIND_RANDOM) randWorld(world, seed);
+
+    /* the agents go in first, so that they find somewhere to be */
+    list = newAgentList(world);
+    srandom(seed);
+    for (a = 0; a < agents; a++) newAgent(list, 0, -1, -1);
+
+    switch (kind) {
+        case KIND_SOUP:
+            soup(world, &r, agents, soupWeights);
+            break;
+
+        case KIND_FLAGS:
+            soup(world, &r, agents, flagWeights);
+            break;
+
+        case KIND_RACES:
+            races(world, &r, agents);
+            break;
+    }
+
+    touchWorld(world);
+    return list;
+}
+
+/* snapshot a world and its agents, and carry on with a world and agents
+ * resumed from the snapshot instead */
+static AgentList *resumeWorld(AgentList *list, unsigned long tick)
+{
+    World *world = list->world;
+    Snapshot snap;
+    Agent *agent;
+    char file[] = "/tmp/rezzo-diff-XXXXXX";
+    int fd, i;
+
+    SF(fd, mkstemp, -1, (file));
+    close(fd);
+    writeSnapshot(file, list, tick);
+    list = newAgentList(readSnapshot(file, &snap));
+    unlink(file);
+
+    list->world->engine = world->engine;
+    list->world->pool = world->pool;
+    list->world->events = newEventRing(EVENT_RING_SZ);
+    for (i = 0; i < snap.nagents; i++) {
+        agent = newAgentAt(list, 0, -1, -1, snap.agents + i);
+        agent->alive = snap.agents[i].alive;
+    }
+    return list;
+}
+
+/* the players who lost this tick, as a set */
+static void lossSet(World *world, unsigned char *set)
+{
+    unsigned char *l;
+    memset(set, 0, 256);
+    for (l = world->losses; *l; l++) set[*l] = 1;
+}
+
+/* say who lost this tick, in order */
+static void printLosses(const char *name, unsigned char *losses)
+{
+    fprintf(stderr, " %s lost", name);
+    if (!*losses) fprintf(stderr, " nobody");
+    for (; *losses; losses++) fprintf(stderr, " %d", (int) *losses);
+}
+
+/* copy the owners of every cell, by index */
+static void copyOwners(World *world, unsigned char *owner)
+{
+    size_t i;
+    int x, y;
+    for (y = 0; y < world->h; y++) {
+        for (x = 0; x < world->w; x++) {
+            i = CELL_AT(world, x, y);
+            owner[i] = cellOwner(world, i);
+        }
+    }
+}
+
+/* check the events of world since *cursor against how its cells changed in
+ * a tick from c and owner, returning 1 (having said how) if they don't match.
+ * Each photon made, flag made and flag dissipated must have an event, and
+ * each event its change */
+static int checkEvents(World *world, unsigned long *cursor, unsigned char *c, unsigned char *owner,
+                       const char *where)
+{
+    static const unsigned char from[] = {CELL_ELECTRON, CELL_PHOTON, CELL_FLAG};
+    static const unsigned char to[] = {CELL_PHOTON, CELL_FLAG, CELL_CONDUCTOR};
+    unsigned char losses[256];
+    unsigned long changes[3] = {0, 0, 0}, events[3] = {0, 0, 0};
+    Event ev;
+    size_t i;
+    int x, y, t, ok;
+
+    lossSet(world, losses);
+    while (readEvent(world->events, cursor, &ev)) {
+        i = CELL_AT(world, ev.x, ev.y);
+        ok = (ev.ts == world->ts);
+        switch (ev.type) {
+            case EVENT_PHOTON:
+            case EVENT_FLAG:
+            case EVENT_FLAG_DISSIPATED:
+                ok = ok && c[i] == from[ev.type] && world->c[i] == to[ev.type] &&
+                    ev.owner == ((ev.type == EVENT_FLAG) ? cellOwner(world, i) : owner[i]);
+                events[ev.type]++;
+                break;
+
+            case EVENT_LOSS:
+                ok = ok && c[i] == CELL_FLAG && ev.owner == owner[i] && (!ev.owner || losses[ev.owner]);
+                break;
+
+            case EVENT_DESTROYED:
+                /* these happen as the agents act, just before the tick */
+                ok = (c[i] == CELL_NONE);
+                break;
+
+            default:
+                ok = 0;
+        }
+        if (!ok) {
+            fprintf(stderr, "%s: a %s event of %d at (%d, %d) doesn't match its cell, "
+                    "which went from %c%d to %c%d\n", where, eventNames[ev.type], (int) ev.owner,
+                    (int) ev.x, (int) ev.y, CELL_CHARS[c[i]], (int) owner[i],
+                    CELL_CHARS[world->c[i]], (int) cellOwner(world, i));
+            return 1;
+        }
+    }
+
+    for (y = 0; y < world->h; y++) {
+        for (x = 0; x < world->w; x++) {
+            i = CELL_AT(world, x, y);
+            for (t = 0; t < 3; t++)
+                if (c[i] == from[t] && world->c[i] == to[t]) changes[t]++;
+        }
+    }
+    for (t = 0; t < 3; t++) {
+        if (changes[t] == events[t]) continue;
+        fprintf(stderr, "%s: %lu cells went from %c to %c, but there were %lu %s events\n",
+                where, changes[t], CELL_CHARS[from[t]], CELL_CHARS[to[t]], events[t], eventNames[t]);
+        return 1;
+    }
+    return 0;
+}
+
+/* describe an event (or the lack of one) for a report */
+static void describeEvent(char *into, Event *ev)
+{
+    if (!ev) {
+        strcpy(into, "no event");
+        return;
+    }
+    sprintf(into, "a %s event of %d at (%d, %d), ts %d", eventNames[ev->type],
+            (int) ev->owner, (int) ev->x, (int) ev->y, (int) ev->ts);
+}
+
+/* compare the events of two worlds since their cursors, returning 1 (having
+ * said how) at the first which differs */
+static int diffEvents(World *wa, unsigned long *cursorA, const char *nameA,
+                      World *wb, unsigned long *cursorB, const char *nameB, const char *where)
+{
+    Event eva, evb;
+    char da[64], db[64];
+    unsigned long n;
+    int ha, hb;
+
+    for (n = 0; ; n++) {
+        ha = readEvent(wa->events, cursorA, &eva);
+        hb = readEvent(wb->events, cursorB, &evb);
+        if (!ha && !hb) return 0;
+        if (ha && hb && eva.type == evb.type && eva.owner == evb.owner && eva.ts == evb.ts &&
+            eva.x == evb.x && eva.y == evb.y) continue;
+
+        describeEvent(da, ha ? &eva : NULL);
+        describeEvent(db, hb ? &evb : NULL);
+        fprintf(stderr, "%s, in event %lu of the step: %s has %s, %s has %s\n",
+                where, n, nameA, da, nameB, db);
+        return 1;
+    }
+}
+
+/* print the neighborhood of a cell, with owners */
+static void printNeighborhood(World *world, unsigned char *c, unsigned char *owner, int x, int y)
+{
+    size_t i;
+    int xi, yi;
+
+    for (yi = y - 2; yi <= y + 2; yi++) {
+        fprintf(stderr, "\t");
+        for (xi = x - 2; xi <= x + 2; xi++) {
+            i = getCell(world, xi, yi);
+            fprintf(stderr, " %c%-3d", CELL_CHARS[c[i]], (int) owner[i]);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+/* step one world through both engines, returning 1 if they diverged */
+static int diff(int kind, unsigned long seed, int w, int h, int blocked, int agents,
+                int steps, int iter, int snapAt, const Engine *ea, const Engine *eb,
+                struct _Pool *pool)
+{
+    static const unsigned char acts[] = {
+        ACT_NOP, ACT_ADVANCE, ACT_TURN_LEFT, ACT_TURN_RIGHT, ACT_BUILD, ACT_HIT
+    };
+    AgentList *la = diffWorld(kind, seed, w, h, 0, agents, ea, pool);
+    AgentList *lb = diffWorld(kind, seed, w, h, blocked, agents, eb, pool);
+    World *wa = la->world, *wb = lb->world;
+    Agent *aa, *ab;
+    unsigned char *prevC, *prevOwner;
+    unsigned long r = seed, cursorA = 0, diffA = 0, diffB = 0;
+    char where[64];
+    size_t sz = wa->csz - wa->pitch - 1, ia, ib;
+    int step, x, y, ret = 0;
+
+    SF(prevC, malloc, NULL, (sz));
+    SF(prevOwner, malloc, NULL, (sz));
+
+    for (step = 0; step < steps && !ret; step++) {
+        /* the agents act at random, the same in both */
+        for (aa = la->head, ab = lb->head; aa; aa = aa->next, ab = ab->next) {
+            unsigned char act = acts[diffRandom(&r) % sizeof(acts)];
+            if (aa->alive) agentReplay(aa, act);
+            if (ab->alive) agentReplay(ab, act);
+        }
+
+        memcpy(prevC, wa->c, sz);
+        copyOwners(wa, prevOwner);
+        updateWorld(wa, iter);
+        updateWorld(wb, iter);
+
+        /* compare every cell */
+        for (y = 0; y < h && !ret; y++) {
+            for (x = 0; x < w; x++) {
+                ia = CELL_AT(wa, x, y);
+                ib = CELL_AT(wb, x, y);
+                if (wa->c[ia] == wb->c[ib] && cellOwner(wa, ia) == cellOwner(wb, ib)) continue;
+                fprintf(stderr, "%s %lu: diverged at tick %lu, cell (%d, %d): "
+                        "%s has %c%d, %s has %c%d\n",
+                        kindNames[kind], seed, (unsigned long) (step + 1) * iter, x, y,
+                        ea->name, CELL_CHARS[wa->c[ia]], (int) cellOwner(wa, ia),
+                        eb->name, CELL_CHARS[wb->c[ib]], (int) cellOwner(wb, ib));
+                fprintf(stderr, "\tbefore the step:\n");
+                printNeighborhood(wa, prevC, prevOwner, x, y);
+                ret = 1;
+                break;
+            }
+        }
+        if (ret) break;
+
+        /* then every event, which should be the same and in the same order */
+        sprintf(where, "%s %lu: diverged at tick %lu", kindNames[kind], seed, (unsigned long) (step + 1) * iter);
+        if (diffEvents(wa, &diffA, ea->name, wb, &diffB, eb->name, where)) {
+            ret = 1;
+            break;
+        }
+
+        /* and the first engine's events against its cells, which only line
+         * up tick by tick */
+        sprintf(where, "%s %lu: at tick %lu", kindNames[kind], seed, (unsigned long) (step + 1) * iter);
+        if (iter == 1) {
+            if (checkEvents(wa, &cursorA, prevC, prevOwner, where)) {
+                ret = 1;
+                break;
+            }
+        } else {
+            cursorA = wa->events->next;
+        }
+
+        /* and who lost, in order */
+        if (strcmp((char *) wa->losses, (char *) wb->losses)) {
+            fprintf(stderr, "%s %lu: diverged at tick %lu, in losses:", kindNames[kind],
+                    seed, (unsigned long) (step + 1) * iter);
+            printLosses(ea->name, wa->losses);
+            printLosses(eb->name, wb->losses);
+            fprintf(stderr, "\n");
+            ret = 1;
+        }
+        agentProcessLosses(la);
+        agentProcessLosses(lb);
+
+        if (step + 1 == snapAt) {
+            lb = resumeWorld(lb, (unsigned long) snapAt * iter);
+            wb = lb->world;
+            diffB = 0;
+        }
+    }
+
+    free(prevC);
+    free(prevOwner);
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    const Engine *ea, *eb;
+    struct _Pool *pool = NULL;
+    int onlyKind = -1, w = 96, h = 96, seeds = 20, steps = 200, iter = 1, agents = 4;
+    int k, i, blocked = 0, snapAt = 0, failed = 0;
+    unsigned long seed = 1, s;
+
+    ea = findEngine("reference");
+    eb = findEngine("fast");
+
+    for (i = 1; i < argc; i++) {
+        char *arg = argv[i];
+        char *nextarg = (i < argc - 1) ? argv[i+1] : NULL;
+#define ARG(x) if (!strcmp(arg, #x))
+#define ARGN(x) if (!strcmp(arg, #x) && nextarg)
+        ARGN(-a) {
+            ea = findEngine(nextarg);
+            if (!ea) {
+                fprintf(stderr, "Unknown engine: %s\n", nextarg);
+                exit(1);
+            }
+            i++;
+        } else ARGN(-b) {
+            eb = findEngine(nextarg);
+            if (!eb) {
+                fprintf(stderr, "Unknown engine: %s\n", nextarg);
+                exit(1);
+            }
+            i++;
+        } else ARGN(-k) {
+            for (onlyKind = 0; onlyKind < KINDS && strcmp(kindNames[onlyKind], nextarg); onlyKind++);
+            i++;
+        } else ARGN(-w) {
+            w = atoi(nextarg);
+            i++;
+        } else ARGN(-h) {
+            h = atoi(nextarg);
+            i++;
+        } else ARGN(-r) {
+            seed = atol(nextarg);
+            i++;
+        } else ARGN(-n) {
+            seeds = atoi(nextarg);
+            i++;
+        } else ARGN(-t) {
+            steps = atoi(nextarg);
+            i++;
+        } else ARGN(-i) {
+            iter = atoi(nextarg);
+            if (iter < 1) iter = 1;
+            i++;
+        } else ARGN(-g) {
+            agents = atoi(nextarg);
+            if (agents > MAX_AGENTS) agents = MAX_AGENTS;
+            i++;
+        } else ARGN(-j) {
+            if (atoi(nextarg) > 1) pool = newPool(atoi(nextarg));
+            i++;
+        } else ARG(-B) {
+            blocked = 1;
+        } else ARGN(-s) {
+            snapAt = atoi(nextarg);
+            i++;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n%s", arg, help_text);
+            exit(1);
+        }
+    }
+
+    /* worlds are never freed, but they're small */
+    for (k = 0; k < KINDS; k++) {
+        if (onlyKind >= 0 && k != onlyKind) continue;
+        for (s = seed; s < seed + seeds; s++)
+            failed += diff(k, s, w, h, blocked, agents, steps, iter, snapAt, ea, eb, pool);
+    }
+
+    fprintf(stderr, "%d of %d worlds diverged between %s and %s.\n", failed,
+            (onlyKind >= 0 ? 1 : KINDS) * seeds, ea->name, eb->name);
+    return failed ? 1 : 0;
+}
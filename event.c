@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event.h"
+#include "helpers.h"
+
+const char *eventNames[] = {"photon", "flag", "flag-dissipated", "loss", "destroyed"};
+
+/* allocate an event ring of at least this size */
+EventRing *newEventRing(unsigned long size)
+{
+    EventRing *ret;
+    SF(ret, malloc, NULL, (sizeof(EventRing)));
+    for (ret->size = 1; ret->size < size; ret->size *= 2);
+    SF(ret->events, malloc, NULL, (sizeof(Event) * ret->size));
+    ret->next = 0;
+    return ret;
+}
+
+/* add an event to a ring */
+void writeEvent(EventRing *ring, Event *event)
+{
+    ring->events[ring->next & (ring->size - 1)] = *event;
+    ring->next++;
+}
+
+/* read the next event from a ring */
+int readEvent(EventRing *ring, unsigned long *cursor, Event *into)
+{
+    if (ring->next - *cursor > ring->size) *cursor = ring->next - ring->size;
+    if (*cursor == ring->next) return 0;
+    *into = ring->events[*cursor & (ring->size - 1)];
+    (*cursor)++;
+    return 1;
+}
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdlib.h>
+
+#include "buffer.h"
+
+typedef struct _Event Event;
+typedef struct _EventRing EventRing;
+
+enum EventTypes {
+    EVENT_PHOTON, /* an electron next to a flag became a photon */
+    EVENT_FLAG, /* a photon became a flag, of owner */
+    EVENT_FLAG_DISSIPATED, /* a flag of owner was dissipated by a photon */
+    EVENT_LOSS, /* a flag of owner touched a base of another player */
+    EVENT_DESTROYED /* a cell was destroyed by a hit from owner */
+};
+
+/* their names, for writing them out */
+extern const char *eventNames[];
+
+/* the size of ring to keep for a reader which reads every tick */
+#define EVENT_RING_SZ 65536
+
+struct _Event {
+    unsigned char type, owner;
+    unsigned char ts; /* the world's ts once the event has happened */
+    unsigned short x, y;
+};
+
+BUFFER(Event, Event);
+
+/* the most recent events, for any number of readers, each with its own
+ * cursor. Readers which fall more than the size behind lose events */
+struct _EventRing {
+    Event *events;
+    unsigned long size; /* a power of two */
+    unsigned long next; /* number of events ever written */
+};
+
+/* allocate an event ring of at least this size */
+EventRing *newEventRing(unsigned long size);
+
+/* add an event to a ring */
+void writeEvent(EventRing *ring, Event *event);
+
+/* read the next event from a ring at *cursor, returning 0 if there are none,
+ * and skipping any which have been overwritten */
+int readEvent(EventRing *ring, unsigned long *cursor, Event *into);
+
+#endif
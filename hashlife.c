@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashlife.h"
+#include "helpers.h"
+
+/* the shortest step worth building a quadtree for */
+#define HASHLIFE_MIN_STEP 16
+
+/* and the longest, so that node sizes fit in an int */
+#define HASHLIFE_MAX_STEP (1<<24)
+
+/* if more than one cell in this many has to be stepped a tick at a time,
+ * it's not worth memoizing the rest */
+#define HASHLIFE_DIRTY_SHARE 16
+
+/* two-bit cell states, and the cells they come from */
+enum HashStates {
+    HASH_NONE, HASH_CONDUCTOR, HASH_ELECTRON, HASH_TAIL
+};
+static const unsigned char hashCells[4] = {
+    CELL_NONE, CELL_CONDUCTOR, CELL_ELECTRON, CELL_ELECTRON_TAIL
+};
+
+/* the state of a world cell, or -1 for cells that never change */
+static int hashState(unsigned char c)
+{
+    switch (c) {
+        case CELL_NONE: return HASH_NONE;
+        case CELL_CONDUCTOR: return HASH_CONDUCTOR;
+        case CELL_ELECTRON: return HASH_ELECTRON;
+        case CELL_ELECTRON_TAIL: return HASH_TAIL;
+    }
+    return -1;
+}
+
+/* is this cell part of a component of wire, photons and flags included? */
+static int isHashWire(unsigned char c)
+{
+    return hashState(c) > 0 || c == CELL_PHOTON || c == CELL_FLAG || c == CELL_FLAG_GEYSER;
+}
+
+static HashLife *newHashLife(int w, int h)
+{
+    HashLife *ret;
+    size_t places;
+    int i;
+
+    SF(ret, malloc, NULL, (sizeof(HashLife)));
+    memset(ret, 0, sizeof(HashLife));
+    ret->w = w;
+    ret->h = h;
+
+    for (i = 0; i < 256; i++) {
+        ret->leaves[i].level = 1;
+        ret->leaves[i].cells = i;
+    }
+
+    ret->nbuckets = HASHLIFE_MAX_NODES / 2;
+    SF(ret->buckets, calloc, NULL, (ret->nbuckets, sizeof(HashNode *)));
+
+    /* one place per four cells is plenty, and beyond it we just don't remember */
+    places = (size_t) w * h / 4;
+    if (places > HASHLIFE_MAX_PLACES) places = HASHLIFE_MAX_PLACES;
+    for (ret->nplaces = 1024; ret->nplaces < places; ret->nplaces *= 2);
+    SF(ret->places, calloc, NULL, (ret->nplaces, sizeof(HashPlace)));
+
+    return ret;
+}
+
+/* forget every node but the leaves */
+static void flushHashLife(HashLife *hl)
+{
+    HashSlab *slab;
+    memset(hl->buckets, 0, hl->nbuckets * sizeof(HashNode *));
+    for (slab = hl->slabs; slab; slab = slab->next) slab->used = 0;
+    hl->slab = hl->slabs;
+    hl->nodes = 0;
+}
+
+/* get the unique node with these quadrants */
+static HashNode *hashNode(HashLife *hl, HashNode *nw, HashNode *ne, HashNode *sw, HashNode *se)
+{
+    HashNode *node, **bucket;
+    size_t hash;
+
+    hash = ((size_t) nw * 3 + (size_t) ne * 5 + (size_t) sw * 7 + (size_t) se * 11) >> 4;
+    bucket = hl->buckets + (hash % hl->nbuckets);
+    for (node = *bucket; node; node = node->next) {
+        if (node->nw == nw && node->ne == ne && node->sw == sw && node->se == se)
+            return node;
+    }
+
+    /* make a new one, if there's room */
+    if (hl->nodes >= HASHLIFE_MAX_NODES) longjmp(hl->full, 1);
+    if (!hl->slab || hl->slab->used == HASHLIFE_SLAB) {
+        if (hl->slab && hl->slab->next) {
+            hl->slab = hl->slab->next;
+        } else {
+            HashSlab *slab;
+            SF(slab, malloc, NULL, (sizeof(HashSlab)));
+            slab->next = NULL;
+            slab->used = 0;
+            if (hl->slab) hl->slab->next = slab;
+            else hl->slabs = slab;
+            hl->slab = slab;
+        }
+    }
+    node = hl->slab->nodes + hl->slab->used++;
+    node->nw = nw;
+    node->ne = ne;
+    node->sw = sw;
+    node->se = se;
+    node->result = NULL;
+    node->level = nw->level + 1;
+    node->cells = 0;
+    node->next = *bucket;
+    *bucket = node;
+    hl->nodes++;
+    return node;
+}
+
+/* step a level 2 node by hand */
+static HashNode *leafResult(HashLife *hl, HashNode *node)
+{
+    unsigned char g[4][4];
+    HashNode *q[4];
+    int i, x, y, xi, yi, electrons, s, cells;
+
+    /* unpack the 4x4 square */
+    q[0] = node->nw; q[1] = node->ne; q[2] = node->sw; q[3] = node->se;
+    for (i = 0; i < 4; i++) {
+        x = (i&1)*2;
+        y = (i>>1)*2;
+        g[y][x] = q[i]->cells & 3;
+        g[y][x+1] = (q[i]->cells >> 2) & 3;
+        g[y+1][x] = (q[i]->cells >> 4) & 3;
+        g[y+1][x+1] = (q[i]->cells >> 6) & 3;
+    }
+
+    /* then step the center */
+    cells = 0;
+    for (i = 0; i < 4; i++) {
+        x = (i&1) + 1;
+        y = (i>>1) + 1;
+        s = g[y][x];
+        if (s == HASH_CONDUCTOR) {
+            electrons = 0;
+            for (yi = y-1; yi <= y+1; yi++)
+                for (xi = x-1; xi <= x+1; xi++)
+                    if (g[yi][xi] == HASH_ELECTRON) electrons++;
+            if (electrons == 1 || electrons == 2) s = HASH_ELECTRON;
+        } else if (s == HASH_ELECTRON) {
+            s = HASH_TAIL;
+        } else if (s == HASH_TAIL) {
+            s = HASH_CONDUCTOR;
+        }
+        cells |= s << (i*2);
+    }
+
+    return hl->leaves + cells;
+}
+
+/* the center of a node of level 3 or above, after 2^(level-2) ticks */
+static HashNode *nodeResult(HashLife *hl, HashNode *node)
+{
+    HashNode *nw, *ne, *sw, *se, *r[9];
+
+    if (node->result) return node->result;
+    if (node->level == 2) return (node->result = leafResult(hl, node));
+
+    nw = node->nw; ne = node->ne; sw = node->sw; se = node->se;
+
+    /* step the nine overlapping subsquares by half */
+    r[0] = nodeResult(hl, nw);
+    r[1] = nodeResult(hl, hashNode(hl, nw->ne, ne->nw, nw->se, ne->sw));
+    r[2] = nodeResult(hl, ne);
+    r[3] = nodeResult(hl, hashNode(hl, nw->sw, nw->se, sw->nw, sw->ne));
+    r[4] = nodeResult(hl, hashNode(hl, nw->se, ne->sw, sw->ne, se->nw));
+    r[5] = nodeResult(hl, hashNode(hl, ne->sw, ne->se, se->nw, se->ne));
+    r[6] = nodeResult(hl, sw);
+    r[7] = nodeResult(hl, hashNode(hl, sw->ne, se->nw, sw->se, se->sw));
+    r[8] = nodeResult(hl, se);
+
+    /* then the four quadrants of the center by the other half */
+    node->result = hashNode(hl,
+        nodeResult(hl, hashNode(hl, r[0], r[1], r[3], r[4])),
+        nodeResult(hl, hashNode(hl, r[1], r[2], r[4], r[5])),
+        nodeResult(hl, hashNode(hl, r[3], r[4], r[6], r[7])),
+        nodeResult(hl, hashNode(hl, r[4], r[5], r[7], r[8])));
+    return node->result;
+}
+
+/* read a level 1 node from the world at this (in-bounds) location */
+static HashNode *buildLeaf(HashLife *hl, World *world, int x, int y)
+{
+    int x1 = (x + 1 == world->w) ? 0 : x + 1;
+    int y1 = (y + 1 == world->h) ? 0 : y + 1;
+    int cells, s;
+
+    s = hashState(world->c[CELL_AT(world, x, y)]);
+    cells = (s < 0) ? 0 : s;
+    s = hashState(world->c[CELL_AT(world, x1, y)]);
+    cells |= ((s < 0) ? 0 : s) << 2;
+    s = hashState(world->c[CELL_AT(world, x, y1)]);
+    cells |= ((s < 0) ? 0 : s) << 4;
+    s = hashState(world->c[CELL_AT(world, x1, y1)]);
+    cells |= ((s < 0) ? 0 : s) << 6;
+
+    return hl->leaves + cells;
+}
+
+/* read a node from the world at this (in-bounds) location, wrapping around
+ * the torus as many times as it takes */
+static HashNode *buildNode(HashLife *hl, World *world, int level, int x, int y)
+{
+    HashPlace *place = NULL;
+    HashNode *node;
+    int half, x1, y1;
+    unsigned int i;
+
+    if (level == 1) return buildLeaf(hl, world, x, y);
+
+    /* big nodes overlap themselves, so remember where we've been */
+    if (level >= 3 && hl->used < hl->nplaces/2) {
+        i = ((unsigned int) level * 0x9E3779B1u ^ (unsigned int) x * 0x85EBCA77u ^
+             (unsigned int) y * 0xC2B2AE3Du) & (hl->nplaces - 1);
+        while (hl->places[i].gen == hl->gen) {
+            if (hl->places[i].level == level && hl->places[i].x == x && hl->places[i].y == y)
+                return hl->places[i].node;
+            i = (i + 1) & (hl->nplaces - 1);
+        }
+        place = hl->places + i;
+    }
+
+    half = 1 << (level-1);
+    x1 = (x + half) % world->w;
+    y1 = (y + half) % world->h;
+    node = hashNode(hl,
+        buildNode(hl, world, level-1, x, y),
+        buildNode(hl, world, level-1, x1, y),
+        buildNode(hl, world, level-1, x, y1),
+        buildNode(hl, world, level-1, x1, y1));
+
+    if (place) {
+        place->gen = hl->gen;
+        place->level = level;
+        place->x = x;
+        place->y = y;
+        place->node = node;
+        hl->used++;
+    }
+    return node;
+}
+
+/* write the part of a node at (x, y) that falls in the window from (wx0, wy0)
+ * to (wx1, wy1) back to the world, skipping cells that never change and
+ * those that didn't this time, so blank pages of the world aren't allocated */
+static void writeNode(World *world, HashNode *node, int x, int y,
+                      int wx0, int wy0, int wx1, int wy1)
+{
+    int sz = 1 << node->level, half = sz / 2, i, cx, cy;
+    unsigned char *c, nc;
+
+    if (x >= wx1 || y >= wy1 || x + sz <= wx0 || y + sz <= wy0) return;
+
+    if (node->level == 1) {
+        for (i = 0; i < 4; i++) {
+            cx = x + (i&1);
+            cy = y + (i>>1);
+            if (cx < wx0 || cx >= wx1 || cy < wy0 || cy >= wy1) continue;
+            c = world->c + CELL_AT(world, cx, cy);
+            nc = hashCells[(node->cells >> (i*2)) & 3];
+            if (hashState(*c) >= 0 && *c != nc) *c = nc;
+        }
+        return;
+    }
+
+    writeNode(world, node->nw, x, y, wx0, wy0, wx1, wy1);
+    writeNode(world, node->ne, x + half, y, wx0, wy0, wx1, wy1);
+    writeNode(world, node->sw, x, y + half, wx0, wy0, wx1, wy1);
+    writeNode(world, node->se, x + half, y + half, wx0, wy0, wx1, wy1);
+}
+
+/* run step (a power of two) ticks of the world, returning 0 (with nothing
+ * written) if it needed too many nodes */
+static int stepHashLife(HashLife *hl, World *world, int step)
+{
+    HashNode **results;
+    int level, block = step * 2, bx, by, x, y, i;
+
+    for (level = 2; (1 << (level-2)) < step; level++);
+
+    /* leave the step plenty of room */
+    if (hl->nodes > HASHLIFE_MAX_NODES / 2) flushHashLife(hl);
+    hl->gen++;
+    hl->used = 0;
+
+    /* each block of the result comes from a node twice its size around it.
+     * Step them all before writing any back, since they overlap */
+    SF(results, malloc, NULL, (sizeof(HashNode *) *
+        ((world->w + block - 1) / block) * ((world->h + block - 1) / block)));
+    if (setjmp(hl->full)) {
+        flushHashLife(hl);
+        free(results);
+        return 0;
+    }
+    for (by = 0, i = 0; by < world->h; by += block) {
+        for (bx = 0; bx < world->w; bx += block, i++) {
+            x = ((bx - step) % world->w + world->w) % world->w;
+            y = ((by - step) % world->h + world->h) % world->h;
+            results[i] = nodeResult(hl, buildNode(hl, world, level, x, y));
+        }
+    }
+
+    for (by = 0, i = 0; by < world->h; by += block) {
+        for (bx = 0; bx < world->w; bx += block, i++) {
+            writeNode(world, results[i], bx, by, bx, by,
+                      (bx + block < world->w) ? bx + block : world->w,
+                      (by + block < world->h) ? by + block : world->h);
+        }
+    }
+
+    free(results);
+    return 1;
+}
+
+static int cmpSize(const void *l, const void *r)
+{
+    size_t a = *(const size_t *) l, b = *(const size_t *) r;
+    return (a < b) ? -1 : (a > b);
+}
+
+/* find the cells that can't be memoized: the components of wire with any
+ * photon, flag or geyser in them. Nothing outside of a component is next to
+ * any of its wire, so they can be stepped apart from the rest of the world.
+ * They go in dirty in the order the reference engine updates cells, and the
+ * halo cells which stand in for them in mirrors, with their index in dirty
+ * in mirrorOf. Returns 0 if there are too many */
+static int findDirty(World *world, struct Buffer_size *dirty, struct Buffer_size *mirrors,
+                     struct Buffer_size *mirrorOf)
+{
+    unsigned char *seen = newCellBits(world), c;
+    size_t i, ni, head, k, limit = (size_t) world->w * world->h / HASHLIFE_DIRTY_SHARE;
+    int x, y, xi, yi, ret = 1;
+
+    for (y = 0; y < world->h && ret; y++) {
+        for (x = 0; x < world->w && ret; x++) {
+            i = CELL_AT(world, x, y);
+            c = world->c[i];
+            if ((c != CELL_PHOTON && c != CELL_FLAG && c != CELL_FLAG_GEYSER) || CELL_BIT(seen, i))
+                continue;
+
+            /* flood fill its component */
+            head = dirty->bufused;
+            SET_CELL_BIT(seen, i);
+            WRITE_ONE_BUFFER(*dirty, i);
+            for (; head < dirty->bufused; head++) {
+                i = dirty->buf[head];
+                for (yi = cellY(world, i) - 1; yi <= cellY(world, i) + 1; yi++) {
+                    for (xi = cellX(world, i) - 1; xi <= cellX(world, i) + 1; xi++) {
+                        ni = getCell(world, xi, yi);
+                        if (!isHashWire(world->c[ni]) || CELL_BIT(seen, ni)) continue;
+                        SET_CELL_BIT(seen, ni);
+                        WRITE_ONE_BUFFER(*dirty, ni);
+                    }
+                }
+            }
+            if (dirty->bufused > limit) ret = 0;
+        }
+    }
+    free(seen);
+    if (!ret) return 0;
+
+    /* sort them by location, rather than by id */
+    for (k = 0; k < dirty->bufused; k++)
+        dirty->buf[k] = (size_t) cellY(world, dirty->buf[k]) * world->w + cellX(world, dirty->buf[k]);
+    qsort(dirty->buf, dirty->bufused, sizeof(size_t), cmpSize);
+    for (k = 0; k < dirty->bufused; k++)
+        dirty->buf[k] = CELL_AT(world, (int) (dirty->buf[k] % world->w), (int) (dirty->buf[k] / world->w));
+
+    /* each neighbor reads a cell at a fixed offset, which may be in a halo */
+    for (k = 0; k < dirty->bufused; k++) {
+        x = cellX(world, dirty->buf[k]);
+        y = cellY(world, dirty->buf[k]);
+        for (yi = -1; yi <= 1; yi++) {
+            for (xi = -1; xi <= 1; xi++) {
+                i = getCell(world, x + xi, y + yi) - (size_t) (yi * world->pitch + xi);
+                if (i == dirty->buf[k]) continue;
+                WRITE_ONE_BUFFER(*mirrors, i);
+                WRITE_ONE_BUFFER(*mirrorOf, k);
+            }
+        }
+    }
+    return 1;
+}
+
+/* step the cells found by findDirty ticks ticks, just as the reference
+ * engine would */
+static void stepDirty(World *world, struct Buffer_size *dirty, struct Buffer_size *mirrors,
+                      struct Buffer_size *mirrorOf, unsigned char *next, int ticks)
+{
+    struct Buffer_OwnerChange owners;
+    struct Buffer_Event events;
+    OwnerChange oc;
+    size_t k;
+
+    INIT_BUFFER(owners);
+    INIT_BUFFER(events);
+
+    while (ticks--) {
+        world->ts++;
+        owners.bufused = events.bufused = 0;
+        for (k = 0; k < dirty->bufused; k++) {
+            if (updateCellIndex(world, dirty->buf[k], next + k, &oc.owner,
+                                world->events ? &events : NULL)) {
+                oc.cell = dirty->buf[k];
+                WRITE_ONE_BUFFER(owners, oc);
+            }
+        }
+
+        for (k = 0; k < dirty->bufused; k++)
+            if (world->c[dirty->buf[k]] != next[k]) world->c[dirty->buf[k]] = next[k];
+        for (k = 0; k < mirrors->bufused; k++)
+            world->c[mirrors->buf[k]] = next[mirrorOf->buf[k]];
+        for (k = 0; k < events.bufused; k++)
+            writeEvent(world->events, events.buf + k);
+        for (k = 0; k < owners.bufused; k++)
+            setOwner(world, owners.buf[k].cell, owners.buf[k].owner);
+    }
+
+    FREE_BUFFER(owners);
+    FREE_BUFFER(events);
+}
+
+/* run up to iter ticks of world as a memoized quadtree */
+int updateWorldHash(World *world, int iter)
+{
+    HashLife *hl;
+    struct Buffer_size dirty, mirrors, mirrorOf;
+    unsigned char *start, *next;
+    size_t k;
+    int step, ran = 0;
+
+    INIT_BUFFER(dirty);
+    INIT_BUFFER(mirrors);
+    INIT_BUFFER(mirrorOf);
+    if (!findDirty(world, &dirty, &mirrors, &mirrorOf)) goto done;
+    SF(start, malloc, NULL, (dirty.bufused + 1));
+    SF(next, malloc, NULL, (dirty.bufused + 1));
+    if (dirty.bufused) refreshHalo(world);
+
+    if (!world->hash) world->hash = newHashLife(world->w, world->h);
+    hl = world->hash;
+
+    for (; iter - ran >= HASHLIFE_MIN_STEP; ran += step) {
+        for (step = HASHLIFE_MIN_STEP; step*2 <= iter - ran && step < HASHLIFE_MAX_STEP; step *= 2);
+
+        /* the quadtree steps the dirty cells too, but wrongly, so put them
+         * back and step them properly */
+        for (k = 0; k < dirty.bufused; k++) start[k] = world->c[dirty.buf[k]];
+        if (!stepHashLife(hl, world, step)) break;
+        for (k = 0; k < dirty.bufused; k++)
+            if (world->c[dirty.buf[k]] != start[k]) world->c[dirty.buf[k]] = start[k];
+        if (dirty.bufused) stepDirty(world, &dirty, &mirrors, &mirrorOf, next, step);
+        else world->ts += step;
+    }
+    free(start);
+    free(next);
+
+    /* anything may have changed, so let the tiles sort themselves out */
+    if (ran) touchWorld(world);
+
+done:
+    FREE_BUFFER(dirty);
+    FREE_BUFFER(mirrors);
+    FREE_BUFFER(mirrorOf);
+    return ran;
+}
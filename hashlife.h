@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HASHLIFE_H
+#define HASHLIFE_H
+
+#include <setjmp.h>
+
+#include "ca.h"
+
+/* below this many ticks, building the quadtree isn't worth it */
+#define HASHLIFE_MIN_ITER 64
+
+/* flush the memoized quadtree once it has this many nodes. A step which
+ * needs more than this on its own is given up on */
+#define HASHLIFE_MAX_NODES (1<<22)
+
+/* the most places to remember, at one per four cells */
+#define HASHLIFE_MAX_PLACES (1<<22)
+
+typedef struct _HashNode HashNode;
+typedef struct _HashSlab HashSlab;
+typedef struct _HashPlace HashPlace;
+typedef struct _HashLife HashLife;
+
+/* a square of 2^level cells. Level 1 nodes hold their four cells (two bits
+ * each, NW, NE, SW, SE from the low bits up), higher levels their four
+ * quadrants. Nodes are unique, so equal squares are equal pointers */
+struct _HashNode {
+    HashNode *nw, *ne, *sw, *se;
+    HashNode *result; /* the center after 2^(level-2) ticks, once known */
+    HashNode *next; /* in the hash table */
+    unsigned char level, cells;
+};
+
+/* nodes are allocated in slabs, which are only freed all at once */
+#define HASHLIFE_SLAB 4096
+struct _HashSlab {
+    HashSlab *next;
+    int used;
+    HashNode nodes[HASHLIFE_SLAB];
+};
+
+/* the node built at a world location, so that the torus is only read once */
+struct _HashPlace {
+    unsigned int gen;
+    int level, x, y;
+    HashNode *node;
+};
+
+struct _HashLife {
+    int w, h;
+    HashNode leaves[256]; /* every level 1 node */
+
+    HashNode **buckets;
+    unsigned int nbuckets, nodes;
+    HashSlab *slabs, *slab;
+
+    HashPlace *places;
+    unsigned int nplaces, used, gen;
+
+    jmp_buf full; /* where to go once there are too many nodes */
+};
+
+/* run up to iter ticks of world as a memoized quadtree. Only plain Wireworld
+ * can be memoized, so the components of wire with photons, flags or geysers
+ * in or next to them (such as those around the agents' bases) are stepped a
+ * tick at a time alongside, unless there's so much of them it isn't worth it.
+ * Returns the number of ticks run, which may be 0 */
+int updateWorldHash(World *world, int iter);
+
+#endif
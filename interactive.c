@@ -73,8 +73,8 @@ void drawViewport(SDL_Surface *buf, int z)
         for (x = 0, wi = wyoff, si = syoff; x < w; x++, wi++, si += z) {
             c = sm.c[wi];
 #define GRP(nm) \
-            if (c >= CELL_ ## nm && c < CELL_ ## nm + 10) { \
-                color = ownerColors[c - CELL_ ## nm + 1]; \
+            if (c >= CELL_CHARS[CELL_ ## nm] && c < CELL_CHARS[CELL_ ## nm] + 10) { \
+                color = ownerColors[c - CELL_CHARS[CELL_ ## nm] + 1]; \
             } else
 
             GRP(AGENT)
@@ -104,7 +104,7 @@ static void initColors(SDL_Surface *buf)
     SF(ownerColors, malloc, NULL, (sizeof(Uint32)*(MAX_AGENTS+1)));
     memset(typeColors, 0, sizeof(Uint32)*(MAX_AGENTS+1));
 
-#define TCOL(c, r, g, b) typeColors[c] = SDL_MapRGB(fmt, r, g, b)
+#define TCOL(c, r, g, b) typeColors[(unsigned char) CELL_CHARS[c]] = SDL_MapRGB(fmt, r, g, b)
 #define ACOL(c, r, g, b) do { \
     ownerColors[c] = SDL_MapRGB(fmt, r, g, b); \
 } while (0)
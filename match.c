@@ -0,0 +1,175 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "actionlog.h"
+#include "helpers.h"
+#include "match.h"
+#include "snapshot.h"
+#include "stats.h"
+
+/* allocate a match around a world */
+Match *newMatch(World *world, long timeout, int mustTimeout)
+{
+    Match *ret;
+    SF(ret, malloc, NULL, (sizeof(Match)));
+    memset(ret, 0, sizeof(Match));
+    ret->world = world;
+    ret->agents = newAgentList(world);
+    ret->timeout = timeout;
+    ret->mustTimeout = mustTimeout;
+    return ret;
+}
+
+/* write the world's events since the last tick to the match's event file */
+static void writeEvents(Match *match)
+{
+    Event ev;
+    while (readEvent(match->world->events, &match->eventCursor, &ev)) {
+        fprintf(match->eventFile, "%lu %s %d %d %d\n", match->ticks, eventNames[ev.type],
+                (int) ev.owner, (int) ev.x, (int) ev.y);
+    }
+    fflush(match->eventFile);
+}
+
+/* tick the match's world */
+void matchTick(Match *match)
+{
+    AgentList *agents = match->agents;
+    STAT_DECL(t)
+
+    /* update the world */
+    if (agents->log) logTick(agents->log);
+    STAT_START(t);
+    updateWorld(match->world, 1);
+    STAT_END(t, STAT_UPDATE);
+
+    /* check for losses */
+    STAT_START(t);
+    agentProcessLosses(agents);
+    STAT_END(t, STAT_LOSSES);
+
+    /* say what happened */
+    match->ticks++;
+    if (match->eventFile) writeEvents(match);
+
+    /* maybe save it */
+    if (match->ticks == match->snapTick && match->snapFile)
+        writeSnapshot(match->snapFile, agents, match->ticks);
+}
+
+static void tvadd(struct timeval *into, struct timeval a, long usec)
+{
+    into->tv_sec = a.tv_sec;
+    into->tv_usec = a.tv_usec + usec;
+    while (into->tv_usec >= 1000000) {
+        into->tv_sec++;
+        into->tv_usec -= 1000000;
+    }
+}
+
+static int tvbefore(struct timeval *a, struct timeval *b)
+{
+    return a->tv_sec < b->tv_sec || (a->tv_sec == b->tv_sec && a->tv_usec < b->tv_usec);
+}
+
+/* start the match's clock */
+void matchStart(Match *match)
+{
+    struct timeval cur;
+    gettimeofday(&cur, NULL);
+    tvadd(&match->turnEnd, cur, match->timeout);
+}
+
+/* add the FDs the match is waiting on to these sets */
+void matchWait(Match *match, fd_set *rdset, fd_set *wrset, int *nfds, struct timeval *wake)
+{
+    Agent *agent;
+
+    for (agent = match->agents->head; agent; agent = agent->next) {
+        if (agent->alive) {
+            FD_SET(agent->rfd, rdset);
+            if (agent->rfd >= *nfds) *nfds = agent->rfd + 1;
+            if (agent->wbuf.bufused) {
+                FD_SET(agent->wfd, wrset);
+                if (agent->wfd >= *nfds) *nfds = agent->wfd + 1;
+            }
+        }
+    }
+
+    if (tvbefore(&match->turnEnd, wake)) *wake = match->turnEnd;
+}
+
+/* handle anything the match's agents are ready for */
+int matchRun(Match *match, fd_set *rdset, fd_set *wrset, struct timeval *now)
+{
+    Agent *agent;
+    int allDone, timedOut;
+    STAT_DECL(t)
+
+    /* figure out which have read actions. The FDs of dead agents may belong
+     * to another match by now */
+    allDone = !match->mustTimeout && match->agents->head;
+    for (agent = match->agents->head; agent; agent = agent->next) {
+        if (agent->alive && FD_ISSET(agent->rfd, rdset))
+            agentIncoming(agent);
+        if (agent->ack == ACK_NO_MESSAGE)
+            allDone = 0;
+    }
+    timedOut = !tvbefore(now, &match->turnEnd);
+
+    /* and maybe do a world step */
+    if (allDone || timedOut) {
+        matchTick(match);
+        STAT_START(t);
+        agentServerMessages(match->agents);
+        STAT_END(t, STAT_VIEWPORT);
+
+        /* how shall we proceed? */
+        if (timedOut) {
+            tvadd(&match->turnEnd, match->turnEnd, match->timeout);
+        } else {
+            /* everybody responded */
+            tvadd(&match->turnEnd, *now, match->timeout);
+        }
+    }
+
+    /* then write actions */
+    STAT_START(t);
+    for (agent = match->agents->head; agent; agent = agent->next) {
+        if (agent->alive && FD_ISSET(agent->wfd, wrset)) {
+            ssize_t wr;
+            wr = write(agent->wfd, agent->wbuf.buf, agent->wbuf.bufused);
+            if (wr <= 0) {
+                /* yukk! */
+                agentDie(agent);
+            } else {
+                memmove(agent->wbuf.buf, agent->wbuf.buf + wr, agent->wbuf.bufused - wr);
+                agent->wbuf.bufused -= wr;
+#ifdef REZZO_STATS
+                if (!agent->wbuf.bufused) agent->sentAt = statNow();
+#endif
+            }
+        }
+    }
+    STAT_END(t, STAT_WRITE);
+
+    return allDone || timedOut;
+}
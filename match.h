@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <stdio.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#include "agent.h"
+#include "ca.h"
+
+typedef struct _Match Match;
+
+/* everything about one match: its world, agents, clock and renderer. One
+ * event loop can run any number of these */
+struct _Match {
+    Match *next; /* matches form a list */
+    World *world;
+    AgentList *agents;
+    void *ui; /* its renderer, or NULL if it isn't shown */
+
+    long timeout; /* per turn, in microseconds */
+    int mustTimeout; /* wait for the timeout even if everybody has moved? */
+    struct timeval turnEnd; /* when this turn times out */
+    unsigned long ticks; /* of the match so far */
+
+    unsigned long snapTick; /* when to save a snapshot to snapFile, if set */
+    char *snapFile;
+
+    FILE *eventFile; /* where to write the world's events each tick, if set */
+    unsigned long eventCursor;
+};
+
+/* allocate a match around a world, with no agents yet */
+Match *newMatch(World *world, long timeout, int mustTimeout);
+
+/* tick the match's world, without telling the agents */
+void matchTick(Match *match);
+
+/* start the match's clock */
+void matchStart(Match *match);
+
+/* add the FDs the match is waiting on to these sets, and bring *wake
+ * forward to its timeout if that's sooner */
+void matchWait(Match *match, fd_set *rdset, fd_set *wrset, int *nfds, struct timeval *wake);
+
+/* handle anything the match's agents are ready for, as selected in these
+ * sets, ticking it if the turn is over. Returns whether it ticked */
+int matchRun(Match *match, fd_set *rdset, fd_set *wrset, struct timeval *now);
+
+#endif
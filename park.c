@@ -0,0 +1,307 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "park.h"
+
+/* allocate the parking for a world */
+Parking *newParking(World *world)
+{
+    Parking *ret;
+    SF(ret, malloc, NULL, (sizeof(Parking)));
+    INIT_BUFFER(ret->parked);
+    ret->sinceSearch = 0;
+    ret->seen = newCellBits(world);
+    INIT_BUFFER(ret->marked);
+    INIT_BUFFER(ret->cells);
+    return ret;
+}
+
+static int isWire(unsigned char c)
+{
+    return (c == CELL_CONDUCTOR || c == CELL_ELECTRON || c == CELL_ELECTRON_TAIL);
+}
+
+static int cmpSize(const void *l, const void *r)
+{
+    size_t a = *(const size_t *) l, b = *(const size_t *) r;
+    return (a < b) ? -1 : (a > b);
+}
+
+/* find a cell in a sorted list, or -1 */
+static int findCell(size_t *cells, int ncells, size_t cell)
+{
+    size_t *found = bsearch(&cell, cells, ncells, sizeof(size_t), cmpSize);
+    return found ? found - cells : -1;
+}
+
+/* flood fill the wire component containing cell i into parking->cells,
+ * returning whether it's isolated: nothing around it can affect it */
+static int fillComponent(World *world, Parking *parking, size_t i)
+{
+    struct Buffer_size *cells = &parking->cells;
+    size_t ni;
+    size_t head;
+    int x, y, xi, yi, isolated = 1;
+    unsigned char nc;
+
+    cells->bufused = 0;
+    WRITE_ONE_BUFFER(*cells, i);
+    SET_CELL_BIT(parking->seen, i);
+    WRITE_ONE_BUFFER(parking->marked, i);
+
+    for (head = 0; head < cells->bufused; head++) {
+        i = cells->buf[head];
+        x = cellX(world, i);
+        y = cellY(world, i);
+        for (yi = y-1; yi <= y+1; yi++) {
+            for (xi = x-1; xi <= x+1; xi++) {
+                ni = getCell(world, xi, yi);
+                nc = world->c[ni];
+                if (isWire(nc)) {
+                    if (CELL_BIT(world->parked, ni)) {
+                        isolated = 0;
+                    } else if (!CELL_BIT(parking->seen, ni)) {
+                        SET_CELL_BIT(parking->seen, ni);
+                        WRITE_ONE_BUFFER(parking->marked, ni);
+                        WRITE_ONE_BUFFER(*cells, ni);
+                    }
+                } else if (nc == CELL_PHOTON || nc == CELL_FLAG || nc == CELL_FLAG_GEYSER) {
+                    isolated = 0;
+                }
+            }
+        }
+    }
+
+    return isolated;
+}
+
+/* run the component in parking->cells on its own until it comes back around,
+ * and park it if it does */
+static void tryPark(World *world, Parking *parking)
+{
+    size_t *cells = parking->cells.buf, ni;
+    int ncells = parking->cells.bufused;
+    int *neigh, *nneigh, *diffStart, i, j, k, x, y, xi, yi, electrons, period;
+    unsigned char *start, *cur, *next, *tmp, c;
+    struct Buffer_size diffCell;
+    struct Buffer_char diffC;
+    Parked *parked;
+
+    qsort(cells, ncells, sizeof(size_t), cmpSize);
+
+    /* find each cell's neighbors within the component */
+    SF(neigh, malloc, NULL, (sizeof(int) * ncells * 8));
+    SF(nneigh, malloc, NULL, (sizeof(int) * ncells));
+    for (i = 0; i < ncells; i++) {
+        x = cellX(world, cells[i]);
+        y = cellY(world, cells[i]);
+        nneigh[i] = 0;
+        for (yi = y-1; yi <= y+1; yi++) {
+            for (xi = x-1; xi <= x+1; xi++) {
+                ni = getCell(world, xi, yi);
+                if (ni == cells[i]) continue;
+                j = findCell(cells, ncells, ni);
+                if (j >= 0) neigh[i*8 + nneigh[i]++] = j;
+            }
+        }
+    }
+
+    /* then run it */
+    SF(start, malloc, NULL, (ncells));
+    SF(cur, malloc, NULL, (ncells));
+    SF(next, malloc, NULL, (ncells));
+    SF(diffStart, malloc, NULL, (sizeof(int) * (PARK_MAX_PERIOD + 1)));
+    INIT_BUFFER(diffCell);
+    INIT_BUFFER(diffC);
+    for (i = 0; i < ncells; i++) start[i] = cur[i] = world->c[cells[i]];
+
+    period = 0;
+    for (k = 0; k < PARK_MAX_PERIOD; k++) {
+        diffStart[k] = diffCell.bufused;
+        for (i = 0; i < ncells; i++) {
+            c = cur[i];
+            if (c == CELL_CONDUCTOR) {
+                electrons = 0;
+                for (j = 0; j < nneigh[i]; j++)
+                    if (cur[neigh[i*8 + j]] == CELL_ELECTRON) electrons++;
+                if (electrons == 1 || electrons == 2) c = CELL_ELECTRON;
+            } else if (c == CELL_ELECTRON) {
+                c = CELL_ELECTRON_TAIL;
+            } else {
+                c = CELL_CONDUCTOR;
+            }
+            next[i] = c;
+            if (c != cur[i]) {
+                WRITE_ONE_BUFFER(diffCell, cells[i]);
+                WRITE_ONE_BUFFER(diffC, c);
+            }
+        }
+        tmp = cur; cur = next; next = tmp;
+
+        if (!memcmp(cur, start, ncells)) {
+            period = k + 1;
+            diffStart[period] = diffCell.bufused;
+            break;
+        }
+    }
+
+    if (period) {
+        SF(parked, malloc, NULL, (sizeof(Parked)));
+        SF(parked->cells, malloc, NULL, (sizeof(size_t) * ncells));
+        memcpy(parked->cells, cells, sizeof(size_t) * ncells);
+        parked->ncells = ncells;
+        parked->period = period;
+        parked->phase = 0;
+        SF(parked->diffStart, realloc, NULL, (diffStart, sizeof(int) * (period + 1)));
+        parked->diffCell = diffCell.buf;
+        parked->diffC = (unsigned char *) diffC.buf;
+        WRITE_ONE_BUFFER(parking->parked, parked);
+
+        for (i = 0; i < ncells; i++) SET_CELL_BIT(world->parked, cells[i]);
+
+    } else {
+        free(diffStart);
+        FREE_BUFFER(diffCell);
+        FREE_BUFFER(diffC);
+
+    }
+
+    free(start);
+    free(cur);
+    free(next);
+    free(neigh);
+    free(nneigh);
+}
+
+/* look for loops in the active tiles to park */
+void parkWorld(World *world)
+{
+    Parking *parking = world->parking;
+    int tx, ty, x, y, xe, ye;
+    size_t i;
+    unsigned char c;
+
+    /* clear just what the last search filled, rather than all of seen */
+    parking->sinceSearch = 0;
+    for (i = 0; i < parking->marked.bufused; i++)
+        CLEAR_CELL_BIT(parking->seen, parking->marked.buf[i]);
+    parking->marked.bufused = 0;
+
+    for (ty = 0; ty < world->th; ty++) {
+        for (tx = 0; tx < world->tw; tx++) {
+            if (!world->active[ty*world->tw + tx]) continue;
+
+            xe = (tx + 1) << TILE_SHIFT;
+            if (xe > world->w) xe = world->w;
+            ye = (ty + 1) << TILE_SHIFT;
+            if (ye > world->h) ye = world->h;
+            for (y = ty << TILE_SHIFT; y < ye; y++) {
+                for (x = tx << TILE_SHIFT, i = CELL_AT(world, x, y); x < xe; x++, i++) {
+                    c = world->c[i];
+                    if ((c != CELL_ELECTRON && c != CELL_ELECTRON_TAIL) ||
+                        CELL_BIT(world->parked, i) || CELL_BIT(parking->seen, i))
+                        continue;
+                    if (fillComponent(world, parking, i) &&
+                        parking->cells.bufused <= PARK_MAX_CELLS)
+                        tryPark(world, parking);
+                }
+            }
+        }
+    }
+}
+
+/* update the parked loops by one tick. Both buffers are written, so that
+ * tiles which are otherwise quiet don't become stale */
+void stepParked(World *world)
+{
+    Parking *parking = world->parking;
+    Parked *parked;
+    size_t pi;
+    int d;
+
+    for (pi = 0; pi < parking->parked.bufused; pi++) {
+        parked = parking->parked.buf[pi];
+        for (d = parked->diffStart[parked->phase]; d < parked->diffStart[parked->phase + 1]; d++)
+            world->c[parked->diffCell[d]] = world->c2[parked->diffCell[d]] = parked->diffC[d];
+        if (++parked->phase == parked->period) parked->phase = 0;
+    }
+}
+
+/* catch the parked loops' phases up */
+void skipParked(World *world, int ticks)
+{
+    Parking *parking = world->parking;
+    Parked *parked;
+    size_t pi;
+
+    for (pi = 0; pi < parking->parked.bufused; pi++) {
+        parked = parking->parked.buf[pi];
+        parked->phase = (parked->phase + ticks) % parked->period;
+    }
+}
+
+/* unpark a loop, so that it's updated normally again */
+static void wake(World *world, size_t pi)
+{
+    Parking *parking = world->parking;
+    Parked *parked = parking->parked.buf[pi];
+    int i, x, y;
+
+    for (i = 0; i < parked->ncells; i++) {
+        CLEAR_CELL_BIT(world->parked, parked->cells[i]);
+        x = cellX(world, parked->cells[i]);
+        y = cellY(world, parked->cells[i]);
+        world->active[(y>>TILE_SHIFT)*world->tw + (x>>TILE_SHIFT)] = 1;
+    }
+
+    free(parked->cells);
+    free(parked->diffStart);
+    free(parked->diffCell);
+    free(parked->diffC);
+    free(parked);
+    parking->parked.buf[pi] = parking->parked.buf[--parking->parked.bufused];
+}
+
+/* wake any loop parked next to this cell */
+void wakeParked(World *world, int x, int y)
+{
+    Parking *parking = world->parking;
+    Parked *parked;
+    size_t ni;
+    size_t pi;
+    int xi, yi;
+
+    for (yi = y-1; yi <= y+1; yi++) {
+        for (xi = x-1; xi <= x+1; xi++) {
+            ni = getCell(world, xi, yi);
+            if (!CELL_BIT(world->parked, ni)) continue;
+
+            /* find its loop */
+            for (pi = 0; pi < parking->parked.bufused; pi++) {
+                parked = parking->parked.buf[pi];
+                if (findCell(parked->cells, parked->ncells, ni) >= 0) {
+                    wake(world, pi);
+                    break;
+                }
+            }
+        }
+    }
+}
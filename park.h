@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef PARK_H
+#define PARK_H
+
+#include "buffer.h"
+#include "ca.h"
+
+/* how often to look for loops to park, in ticks */
+#define PARK_INTERVAL 64
+
+/* the largest loop worth parking, and the longest period we look for */
+#define PARK_MAX_CELLS 1024
+#define PARK_MAX_PERIOD 256
+
+typedef struct _Parked Parked;
+typedef struct _Parking Parking;
+
+/* a wire component (8-connected conductors, electrons and tails with nothing
+ * but blanks, agents and bases around it) which has been found to cycle.
+ * Rather than updating it, each tick we just write the cells that change in
+ * that phase */
+struct _Parked {
+    size_t *cells; /* sorted indices into the world */
+    int ncells;
+    int period, phase;
+
+    /* the changes from phase p to p+1 are diffs[diffStart[p]] to
+     * diffs[diffStart[p+1]] */
+    int *diffStart;
+    size_t *diffCell;
+    unsigned char *diffC;
+};
+
+BUFFER(Parkedp, Parked *);
+
+struct _Parking {
+    struct Buffer_Parkedp parked;
+    int sinceSearch; /* ticks since we last looked for loops */
+
+    unsigned char *seen; /* bits per cell, for flood filling */
+    struct Buffer_size marked; /* the cells set in seen, to clear */
+    struct Buffer_size cells; /* the component being filled */
+};
+
+/* allocate the parking for a world */
+Parking *newParking(World *world);
+
+/* look for loops in the active tiles to park */
+void parkWorld(World *world);
+
+/* update the parked loops by one tick */
+void stepParked(World *world);
+
+/* the parked loops were updated ticks ticks along with everything else, so
+ * just catch their phases up */
+void skipParked(World *world, int ticks);
+
+/* wake any loop parked next to this cell, which has been changed */
+void wakeParked(World *world, int x, int y);
+
+#endif
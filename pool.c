@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+#include "pool.h"
+
+typedef struct _PoolWorker PoolWorker;
+struct _PoolWorker {
+    Pool *pool;
+    int id;
+};
+
+/* the loop run by each worker thread */
+static void *poolThread(void *data)
+{
+    PoolWorker *pw = data;
+    Pool *pool = pw->pool;
+    unsigned long generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        /* wait for a new job */
+        while (pool->generation == generation)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        pool->job(pool->arg, pw->id, pool->workers);
+
+        /* and report that we're done */
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+
+    return NULL;
+}
+
+/* create a pool of this many workers */
+Pool *newPool(int workers)
+{
+    Pool *ret;
+    PoolWorker *pw;
+    int i, tmpi;
+
+    if (workers < 1) workers = 1;
+
+    SF(ret, malloc, NULL, (sizeof(Pool)));
+    memset(ret, 0, sizeof(Pool));
+    ret->workers = workers;
+    pthread_mutex_init(&ret->lock, NULL);
+    pthread_cond_init(&ret->start, NULL);
+    pthread_cond_init(&ret->done, NULL);
+
+    /* worker 0 is whoever calls poolRun, so only make the rest */
+    SF(ret->threads, malloc, NULL, (sizeof(pthread_t) * workers));
+    for (i = 1; i < workers; i++) {
+        SF(pw, malloc, NULL, (sizeof(PoolWorker)));
+        pw->pool = ret;
+        pw->id = i;
+        tmpi = pthread_create(&ret->threads[i], NULL, poolThread, pw);
+        if (tmpi != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            exit(1);
+        }
+    }
+
+    return ret;
+}
+
+/* run a job on every worker in the pool */
+void poolRun(Pool *pool, PoolJob job, void *arg)
+{
+    if (!pool || pool->workers == 1) {
+        job(arg, 0, 1);
+        return;
+    }
+
+    /* start the others */
+    pthread_mutex_lock(&pool->lock);
+    pool->job = job;
+    pool->arg = arg;
+    pool->running = pool->workers - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* do our part */
+    job(arg, 0, pool->workers);
+
+    /* then wait for them */
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* claim the next of count items of a job */
+int poolNext(volatile int *next, int count)
+{
+    int ret = __sync_fetch_and_add(next, 1);
+    return (ret < count) ? ret : -1;
+}
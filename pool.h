@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+
+typedef struct _Pool Pool;
+
+/* a job is run once by every worker, which are numbered 0 to workers-1 */
+typedef void (*PoolJob)(void *arg, int worker, int workers);
+
+struct _Pool {
+    int workers; /* number of workers, including the thread calling poolRun */
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    unsigned long generation; /* incremented for each job */
+    int running; /* workers still running the current job */
+    PoolJob job;
+    void *arg;
+};
+
+/* create a pool of this many workers, which persist until the process exits */
+Pool *newPool(int workers);
+
+/* run a job on every worker in the pool (or just this thread if pool is
+ * NULL), and wait for all of them to finish */
+void poolRun(Pool *pool, PoolJob job, void *arg);
+
+/* claim the next of count items of a job, returning -1 when none are left */
+int poolNext(volatile int *next, int count);
+
+#endif
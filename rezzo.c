@@ -16,6 +16,7 @@
 
 #define _BSD_SOURCE /* for random */
 
+#include <errno.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
@@ -28,23 +29,20 @@
 
 #include <pthread.h>
 
+#include "actionlog.h"
 #include "agent.h"
 #include "buffer.h"
 #include "ca.h"
+#include "match.h"
+#include "pool.h"
+#include "snapshot.h"
+#include "stats.h"
 #include "ui.h"
 
 BUFFER(charp, char *);
 
 /* global (YAY!) properties */
 static int useLocks;
-static int timeout, mustTimeout;
-
-/* info for the agent thread */
-typedef struct _AgentThreadData AgentThreadData;
-struct _AgentThreadData {
-    AgentList *agents;
-    void *ui;
-};
 
 static char help_text[] =
     "Usage: rezzo [options] warrior ... [-- ui-options]\n"
@@ -55,24 +53,54 @@ static char help_text[] =
     "\t-q           Advance to the next turn immediately if all players have\n"
     "\t             moved (quick mode)\n"
     "\t-r N         Set random seed\n"
+    "\t-j N         Update the world with N threads\n"
+    "\t-m N         Run N matches at once, with seeds counting up from the\n"
+    "\t             random seed. Only the first is shown. Files given to\n"
+    "\t             -s, -L and -E get the match's number appended\n"
+    "\t-W N         Run the world for N ticks before the agents join\n"
+    "\t-B           Start from a blank arena instead of a random map. Only\n"
+    "\t             what's built in it takes memory, so it can be huge\n"
+    "\t--blocks     Lay the world's cells out in 64x64 blocks rather than\n"
+    "\t             rows, if its sides are multiples of 64. Neighbors stay\n"
+    "\t             closer in memory, which helps big worlds\n"
+    "\t--engine <name>\n"
+    "\t             Update the world with the named engine: fast (the\n"
+    "\t             default), tiled or reference\n"
+    "\t-s N <file>  Save a snapshot of the match at tick N to file\n"
+    "\t-R <file>    Resume the match from a snapshot, instead of a random\n"
+    "\t             world. Warriors take the places of its agents in order\n"
+    "\t-L <file>    Log the match's actions to file, to be replayed\n"
+    "\t-E <file>    Write the match's events (photons, flags made and\n"
+    "\t             dissipated, losses and destroyed cells) to file, one\n"
+    "\t             per line as: tick type owner x y\n"
+    "\t-P <file>    Replay a logged match as fast as possible, with no\n"
+    "\t             warriors or UI (but still -v, -s and -E)\n"
     "\t-v <dir>     Output a \"video\" (sequence of PPM files) to the given\n"
     "\t             directory\n";
 
-void tick(AgentList *agents)
+/* replay a logged match, with the agents already made */
+static void replay(ActionLog *log, Match *match, int z)
 {
-    World *world = agents->world;
     Agent *agent;
+    unsigned char id, act;
+
+    while (readAction(log, &id, &act)) {
+        if (id == LOG_TICK) {
+            matchTick(match);
+            if (match->ui) drawWorld(match->agents, match->ui, z);
+            statsPoll();
+            continue;
+        }
 
-    /* update the world */
-    updateWorld(world, 1);
-
-    /* check for losses */
-    agentProcessLosses(agents);
-
-    /* tell the agents */
-    for (agent = agents->head; agent; agent = agent->next) {
-        agentServerMessage(agent);
+        for (agent = match->agents->head; agent && agent->id != id; agent = agent->next);
+        if (!agent || !agent->alive) continue;
+        if (act == LOG_DIED)
+            agentDie(agent);
+        else
+            agentReplay(agent, act);
     }
+
+    fprintf(stderr, "Replayed %lu ticks.\n", match->ticks);
 }
 
 void nonblocking(int fd)
@@ -82,19 +110,74 @@ void nonblocking(int fd)
     SF(tmpi, fcntl, -1, (fd, F_SETFL, flags | O_NONBLOCK));
 }
 
+/* fork off a warrior, and make its agent */
+static Agent *spawnAgent(AgentList *agents, char *prog, AgentPlace *place)
+{
+    int rpipe[2], wpipe[2], tmpi;
+    pid_t pid;
+
+    /* prepare our pipes */
+    SF(tmpi, pipe, -1, (rpipe));
+    SF(tmpi, pipe, -1, (wpipe));
+    nonblocking(rpipe[0]);
+    nonblocking(wpipe[1]);
+
+    /* then fork off */
+    SF(pid, fork, -1, ());
+    if (pid == 0) {
+        int maxfd, i;
+        dup2(rpipe[1], 1);
+        dup2(wpipe[0], 0);
+
+        /* close all other FDs */
+        maxfd = sysconf(_SC_OPEN_MAX);
+        for (i = 3; i < maxfd; i++) close(i);
+
+        /* then go */
+        execl(prog, prog, NULL);
+        perror(prog);
+        exit(1);
+    }
+
+    /* close the ends we don't need */
+    close(rpipe[1]);
+    close(wpipe[0]);
+
+    /* then make the agent */
+    return newAgentAt(agents, pid, rpipe[0], wpipe[1], place);
+}
+
+/* the name of a file for match m, of matches */
+static char *matchFile(char *file, int m, int matches)
+{
+    char *ret;
+    if (!file || matches == 1) return file;
+    SF(ret, malloc, NULL, (strlen(file) + 16));
+    sprintf(ret, "%s.%d", file, m);
+    return ret;
+}
+
 void *agentThread(void *datavp);
 pthread_mutex_t bigLock;
 
 int main(int argc, char **argv)
 {
-    int w, h, z, r, i, tmpi;
+    int w, h, z, r, j, m, matches, warm, blank, blocked, i, timeout, mustTimeout;
+    unsigned long snapTick;
     struct timeval tv;
-    void *uibuf;
+    char *resume, *logFile, *replayFile, *snapFile, *eventFile;
+    const Engine *engine;
+    ActionLog *log;
+    ActionLogHeader hdr;
+    Snapshot snap;
     World *world;
-    AgentList *agents;
+    Match *match, *first, *last;
+    struct _Pool *pool;
     struct Buffer_charp agentProgs;
     pthread_t agentPThread;
-    AgentThreadData atd;
+
+    /* the signals for stats only go to the agent thread */
+    statsInit();
 
     /* defaults */
     useLocks = 0;
@@ -102,6 +185,14 @@ int main(int argc, char **argv)
     mustTimeout = 1;
     w = h = 320;
     z = 2;
+    j = 1;
+    matches = 1;
+    warm = 0;
+    blank = blocked = 0;
+    snapTick = 0;
+    resume = logFile = replayFile = snapFile = eventFile = NULL;
+    log = NULL;
+    engine = engines;
     gettimeofday(&tv, NULL);
     r = tv.tv_sec ^ tv.tv_usec ^ getpid();
     srandom(r);
@@ -126,6 +217,43 @@ int main(int argc, char **argv)
         } else ARGN(-r) {
             r = atoi(nextarg);
             i++;
+        } else ARGN(-j) {
+            j = atoi(nextarg);
+            i++;
+        } else ARGN(-m) {
+            matches = atoi(nextarg);
+            if (matches < 1) matches = 1;
+            i++;
+        } else ARGN(-W) {
+            warm = atoi(nextarg);
+            i++;
+        } else ARG(-B) {
+            blank = 1;
+        } else ARG(--blocks) {
+            blocked = 1;
+        } else if (!strcmp(arg, "-s") && i < argc - 2) {
+            snapTick = atol(nextarg);
+            snapFile = argv[i+2];
+            i += 2;
+        } else ARGN(--engine) {
+            engine = findEngine(nextarg);
+            if (!engine) {
+                fprintf(stderr, "Unknown engine: %s\n", nextarg);
+                exit(1);
+            }
+            i++;
+        } else ARGN(-R) {
+            resume = nextarg;
+            i++;
+        } else ARGN(-E) {
+            eventFile = nextarg;
+            i++;
+        } else ARGN(-L) {
+            logFile = nextarg;
+            i++;
+        } else ARGN(-P) {
+            replayFile = nextarg;
+            i++;
         } else ARGN(-v) {
             useLocks = 1;
             video = nextarg;
@@ -163,65 +291,111 @@ int main(int argc, char **argv)
         exit(1);
     }
 
-    fprintf(stderr, "Random seed: %d\n", r);
-    srandom(r);
+    /* a replay is set up just as the match was */
+    memset(&hdr, 0, sizeof(ActionLogHeader));
+    if (replayFile) {
+        if (agentProgs.bufused || matches > 1) {
+            fprintf(stderr, "A replay is of one match, with no warriors.\n");
+            exit(1);
+        }
+        log = openActionLog(replayFile);
+        hdr = log->hdr;
+        r = hdr.seed;
+        w = hdr.w;
+        h = hdr.h;
+        warm = hdr.warm;
+        blank = hdr.blank;
+        resume = hdr.resume[0] ? hdr.resume : NULL;
+    } else {
+        hdr.w = w;
+        hdr.h = h;
+        hdr.warm = warm;
+        hdr.blank = blank;
+        hdr.nagents = agentProgs.bufused;
+        if (resume) strncpy(hdr.resume, resume, sizeof(hdr.resume) - 1);
+    }
 
-    /* make our world */
-    world = newWorld(w, h);
-    randWorld(world);
+    fprintf(stderr, "Random seed: %d\n", r);
+    pool = (j > 1) ? newPool(j) : NULL;
 
     /* ignore sigpipes */
     signal(SIGPIPE, SIG_IGN);
 
-    /* prepare our agents */
-    agents = newAgentList(world);
-    for (i = 0; i < agentProgs.bufused; i++) {
-        char *prog = agentProgs.buf[i];
-        int rpipe[2], wpipe[2];
-        pid_t pid;
-
-        /* prepare our pipes */
-        SF(tmpi, pipe, -1, (rpipe));
-        SF(tmpi, pipe, -1, (wpipe));
-        nonblocking(rpipe[0]);
-        nonblocking(wpipe[1]);
-
-        /* then fork off */
-        SF(pid, fork, -1, ());
-        if (pid == 0) {
-            int maxfd;
-            dup2(rpipe[1], 1);
-            dup2(wpipe[0], 0);
-
-            /* close all other FDs */
-            maxfd = sysconf(_SC_OPEN_MAX);
-            for (i = 3; i < maxfd; i++) close(i);
-
-            /* then go */
-            execl(prog, prog, NULL);
-            perror(prog);
-            exit(1);
+    /* make our matches, which all share the pool */
+    first = last = NULL;
+    for (m = 0; m < matches; m++) {
+        hdr.seed = r + m;
+        srandom(hdr.seed);
+
+        /* make its world */
+        if (resume) {
+            world = readSnapshot(resume, &snap);
+            w = world->w;
+            h = world->h;
+        } else {
+            world = newWorld(w, h, blocked);
+            snap.tick = 0;
+            snap.nagents = 0;
+        }
+        world->pool = pool;
+        world->engine = engine;
+        if (!resume) {
+            if (blank) sparseWorld(world);
+            else randWorld(world, hdr.seed);
+        }
+        if (warm > 0) updateWorld(world, warm);
+
+        match = newMatch(world, timeout, mustTimeout);
+        match->ticks = snap.tick;
+        match->snapTick = snapTick;
+        match->snapFile = matchFile(snapFile, m, matches);
+        if (eventFile) {
+            world->events = newEventRing(EVENT_RING_SZ);
+            SF(match->eventFile, fopen, NULL, (matchFile(eventFile, m, matches), "w"));
         }
+        if (last) last->next = match;
+        else first = match;
+        last = match;
+
+        /* prepare our agents, in the places of the snapshot's if they're alive */
+        for (i = 0; i < hdr.nagents; i++) {
+            AgentPlace *place = (i < snap.nagents && snap.agents[i].alive) ? snap.agents + i : NULL;
+            if (replayFile) {
+                /* nobody's really there */
+                newAgentAt(match->agents, 0, -1, -1, place);
+            } else {
+                agentServerMessage(spawnAgent(match->agents, agentProgs.buf[i], place));
+            }
+        }
+
+        /* the snapshot's agents with nobody to take their places are gone */
+        for (; i < snap.nagents; i++)
+            if (snap.agents[i].alive) agentClear(world, snap.agents[i].id);
+        if (match->snapFile && match->ticks == snapTick)
+            writeSnapshot(match->snapFile, match->agents, match->ticks);
 
-        /* close the ends we don't need */
-        close(rpipe[1]);
-        close(wpipe[0]);
+        if (logFile)
+            match->agents->log = newActionLog(matchFile(logFile, m, matches), &hdr);
+    }
+
+    if (replayFile) {
+        if (video) first->ui = uiInit(argc, argv, first->agents, w, h, z);
 
-        /* then make the agent */
-        agentServerMessage(newAgent(agents, pid, rpipe[0], wpipe[1]));
+        /* there's no agent thread, so the replay takes the signals */
+        statsListen();
+        replay(log, first, z);
+        return 0;
     }
 
-    /* initialize the UI */
-    uibuf = uiInit(argc, argv, agents, w, h, z);
+    /* initialize the UI, of the first match */
+    first->ui = uiInit(argc, argv, first->agents, w, h, z);
 
     /* and the agent thread */
-    atd.agents = agents;
-    atd.ui = uibuf;
     pthread_mutex_init(&bigLock, NULL);
-    pthread_create(&agentPThread, NULL, agentThread, &atd);
+    pthread_create(&agentPThread, NULL, agentThread, first);
 
     /* then do the UI's loop */
-    uiRun(agents, uibuf, z, useLocks ? &bigLock : NULL);
+    uiRun(first->agents, first->ui, z, useLocks ? &bigLock : NULL);
 
     return 0;
 }
@@ -237,27 +411,17 @@ static void tvsub(struct timeval *into, struct timeval a, struct timeval b)
     }
 }
 
-static void tvadd(struct timeval *into, struct timeval a, long usec)
-{
-    into->tv_sec = a.tv_sec;
-    into->tv_usec = a.tv_usec + usec;
-    while (into->tv_usec >= 1000000) {
-        into->tv_sec++;
-        into->tv_usec -= 1000000;
-    }
-}
-
+/* run every match, with one select for all of their agents */
 void *agentThread(void *data)
 {
-    AgentThreadData *atd = data;
-    AgentList *agents = atd->agents;
-    void *ui = atd->ui;
-    Agent *agent;
-    int nfds = 0, allDone, sr;
-    struct timeval cur, next, tv;
+    Match *matches = data, *match;
+    int nfds, sr;
+    struct timeval cur, wake, tv;
+    STAT_DECL(t)
 
-    gettimeofday(&cur, NULL);
-    tvadd(&next, cur, timeout);
+    statsListen();
+    for (match = matches; match; match = match->next)
+        matchStart(match);
 
     if (useLocks) pthread_mutex_lock(&bigLock);
     while (1) {
@@ -266,70 +430,43 @@ void *agentThread(void *data)
         /* figure out who needs what */
         FD_ZERO(&rdset);
         FD_ZERO(&wrset);
-        for (agent = agents->head; agent; agent = agent->next) {
-            if (agent->alive) {
-                FD_SET(agent->rfd, &rdset);
-                if (agent->rfd >= nfds) nfds = agent->rfd + 1;
-                if (agent->wbuf.bufused) {
-                    FD_SET(agent->wfd, &wrset);
-                    if (agent->wfd >= nfds) nfds = agent->wfd + 1;
-                }
-            }
-        }
+        nfds = 0;
+        wake = matches->turnEnd;
+        for (match = matches; match; match = match->next)
+            matchWait(match, &rdset, &wrset, &nfds, &wake);
 
         /* then select something */
         if (useLocks) pthread_mutex_unlock(&bigLock);
         gettimeofday(&cur, NULL);
-        tvsub(&tv, next, cur);
+        tvsub(&tv, wake, cur);
+        STAT_START(t);
         if (tv.tv_sec >= 0) {
-            SF(sr, select, -1, (nfds, &rdset, &wrset, NULL, &tv));
+            SFC(sr, select, -1, (nfds, &rdset, &wrset, NULL, &tv)) {
+                /* a signal for stats is fine */
+                if (errno != EINTR) {
+                    perror("select");
+                    exit(1);
+                }
+                sr = 0;
+            }
         } else {
             sr = 0;
         }
-        if (useLocks) pthread_mutex_lock(&bigLock);
-
-        /* figure out which have read actions */
-        allDone = 1;
-        if (sr > 0) {
-            if (mustTimeout) allDone = 0;
-            for (agent = agents->head; agent; agent = agent->next) {
-                if (FD_ISSET(agent->rfd, &rdset))
-                    agentIncoming(agent);
-                if (agent->ack == ACK_NO_MESSAGE)
-                    allDone = 0;
-            }
-        }
-
-        /* and maybe do a world step */
-        if (allDone) {
-            tick(agents);
-            uiQueueDraw(ui);
-
-            /* how shall we proceed? */
-            if (sr > 0) {
-                /* everybody responded */
-                tvadd(&next, cur, timeout);
-            } else {
-                /* timed out */
-                tvadd(&next, next, timeout);
-            }
+        STAT_END(t, STAT_SELECT);
+        if (sr == 0) {
+            FD_ZERO(&rdset);
+            FD_ZERO(&wrset);
         }
+        statsPoll();
+        STAT_START(t);
+        if (useLocks) pthread_mutex_lock(&bigLock);
+        STAT_END(t, STAT_LOCK);
 
-        /* then write actions */
-        if (sr > 0) {
-            for (agent = agents->head; agent; agent = agent->next) {
-                if (FD_ISSET(agent->wfd, &wrset)) {
-                    ssize_t wr;
-                    wr = write(agent->wfd, agent->wbuf.buf, agent->wbuf.bufused);
-                    if (wr <= 0) {
-                        /* yukk! */
-                        agentDie(agent);
-                    } else {
-                        memmove(agent->wbuf.buf, agent->wbuf.buf + wr, agent->wbuf.bufused - wr);
-                        agent->wbuf.bufused -= wr;
-                    }
-                }
-            }
+        /* then let each match do what it can */
+        gettimeofday(&cur, NULL);
+        for (match = matches; match; match = match->next) {
+            if (matchRun(match, &rdset, &wrset, &cur) && match->ui)
+                uiQueueDraw(match->ui);
         }
     }
     if (useLocks) pthread_mutex_unlock(&bigLock);
@@ -54,10 +54,8 @@ static void drawSpot(World *world, void *bufvp, int x, int y, int z,
     unsigned char *pix;
     unsigned char or, og, ob, nr, ng, nb;
 
-    while (x < 0) x += world->w;
-    while (x >= world->w) x -= world->w;
-    while (y < 0) y += world->h;
-    while (y >= world->h) y -= world->h;
+    x = WRAP_X(world, x);
+    y = WRAP_Y(world, y);
 
     pix = buf->pix;
     i = buf->w*y*z*z*4 + x*z*4;
@@ -78,25 +76,34 @@ static void drawSpot(World *world, void *bufvp, int x, int y, int z,
 }
 
 void drawWorld(AgentList *agents, void *bufvp, int z)
+{
+    if (!video) return;
+    renderWorld(agents, bufvp, z);
+    writeFrame(bufvp, z);
+}
+
+/* draw the world into the buffer's image */
+void renderWorld(AgentList *agents, void *bufvp, int z)
 {
     HeadlessBuf *buf = bufvp;
     World *world = agents->world;
-    int w, h, x, y, zx, zy, wyoff, syoff, wi, si;
+    int w, h, x, y, n, zx, zy, syoff, si;
+    size_t wi;
     unsigned char r, g, b;
     Agent *agent;
     unsigned char *pix = buf->pix;
 
-    if (!video) return;
-
     /* draw the substrate */
     w = world->w;
     h = world->h;
-    for (y = 0, wyoff = 0, syoff = 0; y < h; y++, wyoff += w, syoff += w*z*z*4) {
-        for (x = 0, wi = wyoff, si = syoff; x < w; x++, wi++, si += z*4) {
+    for (y = 0, syoff = 0; y < h; y++, syoff += w*z*z*4) {
+        for (x = 0, n = 0, si = syoff; x < w; x++, wi++, n--, si += z*4) {
+            if (!n) wi = cellRun(world, x, y, &n);
             if (world->c[wi] == CELL_FLAG) {
-                r = ownerColors[0][world->owner[wi]];
-                g = ownerColors[1][world->owner[wi]];
-                b = ownerColors[2][world->owner[wi]];
+                unsigned char owner = cellMapGet(&world->owners, wi);
+                r = ownerColors[0][owner];
+                g = ownerColors[1][owner];
+                b = ownerColors[2][owner];
             } else {
                 r = typeColors[0][world->c[wi]];
                 g = typeColors[1][world->c[wi]];
@@ -138,58 +145,63 @@ void drawWorld(AgentList *agents, void *bufvp, int z)
             }
         }
     }
+}
 
-    /* maybe write it out */
-    {
-        FILE *fout = NULL;
-        png_structp png = NULL;
-        png_infop pngi = NULL;
-        static char *fnm = NULL;
-        png_byte **rowptrs = NULL;
-        frame++;
-
-        /* open the file */
-        if (fnm == NULL)
-            SF(fnm, malloc, NULL, (strlen(video) + 128));
-        sprintf(fnm, "%s/%08lu.png", video, frame);
-        SF(fout, fopen, NULL, (fnm, "wb"));
-
-        /* prepare PNG */
-        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
-        if (!png) goto pngFail;
-        pngi = png_create_info_struct(png);
-        if (!pngi) goto pngFail;
-        if (setjmp(png_jmpbuf(png))) goto pngFail;
-        png_init_io(png, fout);
-
-        png_set_IHDR(png, pngi, buf->w, buf->h, 8, PNG_COLOR_TYPE_RGB_ALPHA,
-            PNG_INTERLACE_ADAM7, PNG_COMPRESSION_TYPE_DEFAULT,
-            PNG_FILTER_TYPE_DEFAULT);
-
-        /* set up the row pointers */
-        rowptrs = alloca(buf->h * sizeof(png_byte *));
-        for (y = 0, x = 0; y < buf->h; y++, x += buf->w * z * 4) {
-            rowptrs[y] = (png_byte *) pix + x;
-        }
-        png_set_rows(png, pngi, rowptrs);
+/* write the buffer's image out as the next frame of the video */
+void writeFrame(void *bufvp, int z)
+{
+    HeadlessBuf *buf = bufvp;
+    unsigned char *pix = buf->pix;
+    int x, y;
+    FILE *fout = NULL;
+    png_structp png = NULL;
+    png_infop pngi = NULL;
+    static char *fnm = NULL;
+    png_byte **rowptrs = NULL;
+
+    frame++;
+
+    /* open the file */
+    if (fnm == NULL)
+        SF(fnm, malloc, NULL, (strlen(video) + 128));
+    sprintf(fnm, "%s/%08lu.png", video, frame);
+    SF(fout, fopen, NULL, (fnm, "wb"));
+
+    /* prepare PNG */
+    png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!png) goto pngFail;
+    pngi = png_create_info_struct(png);
+    if (!pngi) goto pngFail;
+    if (setjmp(png_jmpbuf(png))) goto pngFail;
+    png_init_io(png, fout);
+
+    png_set_IHDR(png, pngi, buf->w, buf->h, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+        PNG_INTERLACE_ADAM7, PNG_COMPRESSION_TYPE_DEFAULT,
+        PNG_FILTER_TYPE_DEFAULT);
+
+    /* set up the row pointers */
+    rowptrs = alloca(buf->h * sizeof(png_byte *));
+    for (y = 0, x = 0; y < buf->h; y++, x += buf->w * z * 4) {
+        rowptrs[y] = (png_byte *) pix + x;
+    }
+    png_set_rows(png, pngi, rowptrs);
 
-        /* then write it out (FIXME: assuming little-endian, which needs to be swapped) */
-        png_write_png(png, pngi, PNG_TRANSFORM_IDENTITY, NULL);
+    /* then write it out (FIXME: assuming little-endian, which needs to be swapped) */
+    png_write_png(png, pngi, PNG_TRANSFORM_IDENTITY, NULL);
 
 pngFail:
-        if (png) png_destroy_write_struct(&png, pngi ? &pngi : NULL);
-        fclose(fout);
-    }
+    if (png) png_destroy_write_struct(&png, pngi ? &pngi : NULL);
+    fclose(fout);
 }
 
 static void initColors()
 {
-    SF(typeColors[0], malloc, NULL, (256));
-    memset(typeColors[0], 0, 256);
-    SF(typeColors[1], malloc, NULL, (256));
-    memset(typeColors[1], 0, 256);
-    SF(typeColors[2], malloc, NULL, (256));
-    memset(typeColors[2], 0, 256);
+    SF(typeColors[0], malloc, NULL, (CELL_TYPES));
+    memset(typeColors[0], 0, CELL_TYPES);
+    SF(typeColors[1], malloc, NULL, (CELL_TYPES));
+    memset(typeColors[1], 0, CELL_TYPES);
+    SF(typeColors[2], malloc, NULL, (CELL_TYPES));
+    memset(typeColors[2], 0, CELL_TYPES);
 
     SF(ownerColors[0], malloc, NULL, (256));
     memset(ownerColors[0], 0, 256);
@@ -224,7 +236,9 @@ void *uiInit(int argc, char **argv, AgentList *agents, int w, int h, int z)
         exit(1);
     }
 
-    sz = sizeof(HeadlessBuf) + w*h*z*z*4;
+    /* the image is only needed if we're writing video */
+    sz = sizeof(HeadlessBuf);
+    if (video) sz += (size_t) w*h*z*z*4;
     SF(buf, malloc, NULL, (sz));
     memset(buf, -1, sz);
     buf->w = w;
@@ -43,10 +43,8 @@ static void drawSpot(World *world, void *bufvp, int x, int y, int z,
     Uint32 *pix;
     unsigned char or, og, ob, nr, ng, nb;
 
-    while (x < 0) x += world->w;
-    while (x >= world->w) x -= world->w;
-    while (y < 0) y += world->h;
-    while (y >= world->h) y -= world->h;
+    x = WRAP_X(world, x);
+    y = WRAP_Y(world, y);
 
     i = y*z*buf->w + x*z;
     pix = buf->pixels;
@@ -66,7 +64,8 @@ void drawWorld(AgentList *agents, void *bufvp, int z)
 {
     SDL_Surface *buf = bufvp;
     World *world = agents->world;
-    int w, h, x, y, zx, zy, wyoff, syoff, wi, si;
+    int w, h, x, y, n, zx, zy, syoff, si;
+    size_t wi;
     Uint32 color;
     unsigned char r, g, b;
     Agent *agent;
@@ -77,10 +76,11 @@ void drawWorld(AgentList *agents, void *bufvp, int z)
     /* draw the substrate */
     w = world->w;
     h = world->h;
-    for (y = 0, wyoff = 0, syoff = 0; y < h; y++, wyoff += w, syoff += w*z*z) {
-        for (x = 0, wi = wyoff, si = syoff; x < w; x++, wi++, si += z) {
+    for (y = 0, syoff = 0; y < h; y++, syoff += w*z*z) {
+        for (x = 0, n = 0, si = syoff; x < w; x++, wi++, n--, si += z) {
+            if (!n) wi = cellRun(world, x, y, &n);
             if (world->c[wi] == CELL_FLAG) {
-                color = ownerColors32[world->owner[wi]];
+                color = ownerColors32[cellMapGet(&world->owners, wi)];
             } else {
                 color = typeColors[world->c[wi]];
             }
@@ -170,8 +170,8 @@ static void initColors(SDL_Surface *buf)
 {
     SDL_PixelFormat *fmt = buf->format;
 
-    SF(typeColors, malloc, NULL, (sizeof(Uint32)*256));
-    memset(typeColors, 0, sizeof(Uint32)*256);
+    SF(typeColors, malloc, NULL, (sizeof(Uint32)*CELL_TYPES));
+    memset(typeColors, 0, sizeof(Uint32)*CELL_TYPES);
 
     SF(ownerColors[0], malloc, NULL, (MAX_AGENTS+1));
     SF(ownerColors[1], malloc, NULL, (MAX_AGENTS+1));
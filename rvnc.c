@@ -55,10 +55,8 @@ static void drawSpot(World *world, void *bufvp, int x, int y, int z,
     unsigned char *pix;
     unsigned char or, og, ob, nr, ng, nb;
 
-    while (x < 0) x += world->w;
-    while (x >= world->w) x -= world->w;
-    while (y < 0) y += world->h;
-    while (y >= world->h) y -= world->h;
+    x = WRAP_X(world, x);
+    y = WRAP_Y(world, y);
 
     pix = (unsigned char *) buf->rfb->frameBuffer;
     i = buf->w*y*z*z*4 + x*z*4;
@@ -82,7 +80,8 @@ void drawWorld(AgentList *agents, void *bufvp, int z)
 {
     VNCBuf *buf = bufvp;
     World *world = agents->world;
-    int w, h, x, y, zx, zy, wyoff, syoff, wi, si;
+    int w, h, x, y, n, zx, zy, syoff, si;
+    size_t wi;
     unsigned char r, g, b;
     Agent *agent;
     unsigned char *pix = (unsigned char *) buf->rfb->frameBuffer;
@@ -90,12 +89,14 @@ void drawWorld(AgentList *agents, void *bufvp, int z)
     /* draw the substrate */
     w = world->w;
     h = world->h;
-    for (y = 0, wyoff = 0, syoff = 0; y < h; y++, wyoff += w, syoff += w*z*z*4) {
-        for (x = 0, wi = wyoff, si = syoff; x < w; x++, wi++, si += z*4) {
+    for (y = 0, syoff = 0; y < h; y++, syoff += w*z*z*4) {
+        for (x = 0, n = 0, si = syoff; x < w; x++, wi++, n--, si += z*4) {
+            if (!n) wi = cellRun(world, x, y, &n);
             if (world->c[wi] == CELL_FLAG) {
-                r = ownerColors[0][world->owner[wi]];
-                g = ownerColors[1][world->owner[wi]];
-                b = ownerColors[2][world->owner[wi]];
+                unsigned char owner = cellMapGet(&world->owners, wi);
+                r = ownerColors[0][owner];
+                g = ownerColors[1][owner];
+                b = ownerColors[2][owner];
             } else {
                 r = typeColors[0][world->c[wi]];
                 g = typeColors[1][world->c[wi]];
@@ -185,12 +186,12 @@ pngFail:
 
 static void initColors()
 {
-    SF(typeColors[0], malloc, NULL, (256));
-    memset(typeColors[0], 0, 256);
-    SF(typeColors[1], malloc, NULL, (256));
-    memset(typeColors[1], 0, 256);
-    SF(typeColors[2], malloc, NULL, (256));
-    memset(typeColors[2], 0, 256);
+    SF(typeColors[0], malloc, NULL, (CELL_TYPES));
+    memset(typeColors[0], 0, CELL_TYPES);
+    SF(typeColors[1], malloc, NULL, (CELL_TYPES));
+    memset(typeColors[1], 0, CELL_TYPES);
+    SF(typeColors[2], malloc, NULL, (CELL_TYPES));
+    memset(typeColors[2], 0, CELL_TYPES);
 
     SF(ownerColors[0], malloc, NULL, (256));
     memset(ownerColors[0], 0, 256);
@@ -237,7 +238,7 @@ void *uiInit(int argc, char **argv, AgentList *agents, int w, int h, int z)
     if (!buf->rfb->neverShared) buf->rfb->alwaysShared = TRUE;
 
     /* framebuffer info */
-    SF(buf->rfb->frameBuffer, malloc, NULL, (w*h*z*z*4));
+    SF(buf->rfb->frameBuffer, malloc, NULL, ((size_t) w*h*z*z*4));
     rfbSetCursor(buf->rfb, NULL);
 
     initColors();
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "helpers.h"
+#include "snapshot.h"
+
+#define ALIGN(x) (((x) + SNAPSHOT_ALIGN - 1) & ~((size_t) SNAPSHOT_ALIGN - 1))
+
+/* write the cells of a cell map, then their values */
+static void writeCellMap(FILE *fh, CellMap *map)
+{
+    size_t i, tmpz;
+    for (i = 0; i < map->size; i++) {
+        if (map->cells[i] != CELLMAP_EMPTY) {
+            SF(tmpz, fwrite, 0, (map->cells + i, sizeof(size_t), 1, fh));
+        }
+    }
+    for (i = 0; i < map->size; i++) {
+        if (map->cells[i] != CELLMAP_EMPTY) {
+            SF(tmpz, fwrite, 0, (map->vals + i, 1, 1, fh));
+        }
+    }
+}
+
+/* read n cells and values into a cell map, returning 0 if any cell is
+ * outside of csz */
+static int readCellMap(FILE *fh, CellMap *map, size_t n, size_t csz)
+{
+    size_t *cells, tmpz, i;
+    unsigned char *vals;
+
+    if (!n) return 1;
+    SF(cells, malloc, NULL, (sizeof(size_t) * n));
+    SF(vals, malloc, NULL, (n));
+    SF(tmpz, fread, 0, (cells, sizeof(size_t) * n, 1, fh));
+    SF(tmpz, fread, 0, (vals, n, 1, fh));
+    for (i = 0; i < n && cells[i] < csz; i++) cellMapSet(map, cells[i], vals[i]);
+    free(cells);
+    free(vals);
+    return i == n;
+}
+
+/* write a snapshot of the world and its agents */
+void writeSnapshot(const char *file, AgentList *agents, unsigned long tick)
+{
+    World *world = agents->world;
+    Snapshot snap;
+    struct Buffer_size *owned[MAX_AGENTS + 1];
+    Agent *agent;
+    AgentPlace *place;
+    FILE *fh;
+    size_t off, tmpz;
+    int i;
+
+    memset(&snap, 0, sizeof(Snapshot));
+    memcpy(snap.magic, SNAPSHOT_MAGIC, sizeof(snap.magic));
+    snap.version = SNAPSHOT_VERSION;
+    snap.hdrSz = sizeof(Snapshot);
+    snap.tick = tick;
+    snap.w = world->w;
+    snap.h = world->h;
+    snap.pitch = world->pitch;
+    snap.blocked = world->blocked;
+    snap.csz = world->csz;
+    snap.ts = world->ts;
+
+    for (agent = agents->head; agent; agent = agent->next) {
+        if (snap.nagents == MAX_AGENTS) {
+            fprintf(stderr, "Not writing %s: snapshots hold at most %d agents.\n", file, MAX_AGENTS);
+            return;
+        }
+        place = snap.agents + snap.nagents++;
+        place->id = agent->id;
+        place->alive = agent->alive;
+        place->x = agent->x;
+        place->y = agent->y;
+        place->c = agent->c;
+        place->startx = agent->startx;
+        place->starty = agent->starty;
+    }
+
+    /* only agents own anything */
+    for (i = 1; i <= MAX_AGENTS; i++) {
+        owned[i] = ownedCells(world, i);
+        snap.nowned[i] = owned[i]->bufused;
+    }
+
+    /* lay out the cells after everything else */
+    snap.nowners = world->owners.used;
+    snap.ndamage = world->damage.used;
+    off = sizeof(Snapshot) + world->ow*world->oh;
+    for (i = 1; i <= MAX_AGENTS; i++) off += sizeof(size_t) * snap.nowned[i];
+    off += (sizeof(size_t) + 1) * (snap.nowners + snap.ndamage);
+    snap.cOff = ALIGN(off);
+
+    SF(fh, fopen, NULL, (file, "wb"));
+    SF(tmpz, fwrite, 0, (&snap, sizeof(Snapshot), 1, fh));
+    for (i = 1; i <= MAX_AGENTS; i++) {
+        if (!snap.nowned[i]) continue;
+        SF(tmpz, fwrite, 0, (owned[i]->buf, sizeof(size_t) * snap.nowned[i], 1, fh));
+    }
+    SF(tmpz, fwrite, 0, (world->occupied, world->ow*world->oh, 1, fh));
+    writeCellMap(fh, &world->owners);
+    writeCellMap(fh, &world->damage);
+
+    /* c with its halo */
+    SF(i, fseeko, -1, (fh, snap.cOff, SEEK_SET));
+    SF(tmpz, fwrite, 0, (world->c - world->pitch - 1, world->csz, 1, fh));
+    SF(i, fclose, EOF, (fh));
+}
+
+/* why the header of a snapshot file of fsz bytes doesn't describe a world
+ * which fits in it, or NULL if it does */
+static const char *badSnapshot(Snapshot *snap, size_t fsz)
+{
+    AgentPlace *place;
+    size_t csz, off, left;
+    int pitch, i;
+
+    /* the geometry, as newWorldFrom would lay it out */
+    if (snap->w <= 0 || snap->h <= 0 || snap->w > INT_MAX - 2 || snap->h > INT_MAX - 2)
+        return "has an impossible size";
+    if (snap->blocked) {
+        if (snap->blocked != 1 || snap->w % BLOCK_SZ || snap->h % BLOCK_SZ)
+            return "has impossible blocks";
+        pitch = BLOCK_PITCH;
+        csz = (size_t) (snap->w >> BLOCK_SHIFT) * (snap->h >> BLOCK_SHIFT) * BLOCK_CELLS;
+    } else {
+        pitch = snap->w + 2;
+        csz = ((size_t) snap->w + 2) * ((size_t) snap->h + 2);
+    }
+    if (snap->pitch != pitch || snap->csz != csz)
+        return "has cells of the wrong size";
+    if (snap->cOff % SNAPSHOT_ALIGN || snap->cOff > fsz || fsz - snap->cOff < csz)
+        return "is truncated";
+
+    /* everything between the header and the cells */
+    off = sizeof(Snapshot) +
+        (size_t) ((snap->w + OCC_SZ - 1) >> OCC_SHIFT) * ((snap->h + OCC_SZ - 1) >> OCC_SHIFT);
+    if (off > snap->cOff) return "is truncated";
+    left = snap->cOff - off;
+    for (i = 1; i <= MAX_AGENTS; i++) {
+        if (snap->nowned[i] > left / sizeof(size_t)) return "has too many owned cells";
+        left -= sizeof(size_t) * snap->nowned[i];
+    }
+    if (snap->nowners > left / (sizeof(size_t) + 1)) return "has too many owners";
+    left -= (sizeof(size_t) + 1) * snap->nowners;
+    if (snap->ndamage > left / (sizeof(size_t) + 1)) return "has too much damage";
+
+    /* and the agents, which must be in the world */
+    if (snap->nagents < 0 || snap->nagents > MAX_AGENTS) return "has too many agents";
+    for (i = 0, place = snap->agents; i < snap->nagents; i++, place++) {
+        if (place->id < 1 || place->id > MAX_AGENTS ||
+            place->x < 0 || place->x >= snap->w || place->y < 0 || place->y >= snap->h ||
+            place->startx < 0 || place->startx >= snap->w ||
+            place->starty < 0 || place->starty >= snap->h ||
+            place->c < 0 || place->c >= CARDINALITIES)
+            return "has an agent out of place";
+    }
+
+    return NULL;
+}
+
+/* map the cells from a snapshot */
+static unsigned char *mapCells(int fd, Snapshot *snap, size_t off)
+{
+    unsigned char *ret;
+    SF(ret, mmap, MAP_FAILED, (NULL, snap->csz,
+                               PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, off));
+    return ret + snap->pitch + 1;
+}
+
+/* map a world from a snapshot */
+World *readSnapshot(const char *file, Snapshot *snap)
+{
+    World *world;
+    FILE *fh;
+    struct stat sbuf;
+    unsigned char *c;
+    const char *bad;
+    size_t tmpz, k;
+    int i;
+
+    SF(fh, fopen, NULL, (file, "rb"));
+    if (fread(snap, sizeof(Snapshot), 1, fh) != 1 ||
+        memcmp(snap->magic, SNAPSHOT_MAGIC, sizeof(snap->magic)) ||
+        snap->version != SNAPSHOT_VERSION || snap->hdrSz != sizeof(Snapshot)) {
+        fprintf(stderr, "%s is not a snapshot from this version of rezzo on this machine.\n", file);
+        exit(1);
+    }
+    SF(i, fstat, -1, (fileno(fh), &sbuf));
+    if ((bad = badSnapshot(snap, sbuf.st_size))) {
+        fprintf(stderr, "%s %s.\n", file, bad);
+        exit(1);
+    }
+
+    /* c2 is just another private mapping of c, so they start out the same */
+    c = mapCells(fileno(fh), snap, snap->cOff);
+    world = newWorldFrom(snap->w, snap->h, snap->blocked, c, mapCells(fileno(fh), snap, snap->cOff));
+    world->ts = snap->ts;
+
+    /* the rest is small enough to just read */
+    for (i = 1; i <= MAX_AGENTS; i++) {
+        if (!snap->nowned[i]) continue;
+        INIT_BUFFER(world->owned[i]);
+        while (BUFFER_SPACE(world->owned[i]) < snap->nowned[i]) EXPAND_BUFFER(world->owned[i]);
+        SF(tmpz, fread, 0, (world->owned[i].buf, sizeof(size_t) * snap->nowned[i], 1, fh));
+        world->owned[i].bufused = snap->nowned[i];
+        for (k = 0; k < snap->nowned[i]; k++)
+            if (world->owned[i].buf[k] >= snap->csz) goto corrupt;
+    }
+    SF(tmpz, fread, 0, (world->occupied, world->ow*world->oh, 1, fh));
+    if (!readCellMap(fh, &world->owners, snap->nowners, snap->csz) ||
+        !readCellMap(fh, &world->damage, snap->ndamage, snap->csz))
+        goto corrupt;
+    fclose(fh);
+
+    /* parked loops aren't kept, and their tiles may have gone inactive, so
+     * every tile that isn't blank starts out active and they're found again */
+    touchWorld(world);
+
+    return world;
+
+corrupt:
+    fprintf(stderr, "%s has cells outside of the world.\n", file);
+    exit(1);
+}
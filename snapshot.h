@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "agent.h"
+#include "ca.h"
+
+#define SNAPSHOT_MAGIC "REZZOSNP"
+#define SNAPSHOT_VERSION 5
+
+/* the cells start at a multiple of this, so they can be mapped */
+#define SNAPSHOT_ALIGN 65536
+
+typedef struct _Snapshot Snapshot;
+
+/* a snapshot file is this header, in the byte order and sizes of the machine
+ * which wrote it, followed by the owned cells of each agent in order, the
+ * per-block occupancy, and the owners and damage (each as its cells, then
+ * their values). Then, at cOff, is c with its halo
+ * (csz bytes, in rows or blocks), exactly as it is in memory */
+struct _Snapshot {
+    char magic[8];
+    unsigned int version, hdrSz;
+    unsigned long tick; /* ticks of the match so far */
+    int w, h, pitch, blocked;
+    size_t csz;
+    unsigned char ts;
+    int nagents;
+    AgentPlace agents[MAX_AGENTS];
+    size_t nowned[MAX_AGENTS + 1]; /* per owner, the number of owned cells */
+    size_t nowners, ndamage; /* the number of cells with owners and damage */
+    size_t cOff;
+};
+
+/* write a snapshot of the world and its agents, tick ticks into the match */
+void writeSnapshot(const char *file, AgentList *agents, unsigned long tick);
+
+/* map a world from a snapshot, with copy-on-write pages, and read its header
+ * into snap */
+World *readSnapshot(const char *file, Snapshot *snap);
+
+#endif
@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifdef REZZO_STATS
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "buffer.h"
+#include "helpers.h"
+#include "stats.h"
+
+BUFFER(Histogramp, Histogram *);
+
+Histogram statPhases[STAT_PHASES] = {
+    {"update"}, {"losses"}, {"viewport"}, {"select"}, {"write"}, {"lock"}
+};
+volatile sig_atomic_t statsDump = 0, statsQuit = 0;
+static struct Buffer_Histogramp others;
+
+/* the monotonic time in nanoseconds */
+unsigned long statNow(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* values below 2^(HIST_SUB_BITS+1) get a bucket each, and above that, each
+ * power of two gets 2^HIST_SUB_BITS buckets */
+static int histBucket(unsigned long v)
+{
+    int e;
+    if (v < (2 << HIST_SUB_BITS)) return v;
+    e = (8 * sizeof(long) - 1 - __builtin_clzl(v)) - HIST_SUB_BITS;
+    return (e << HIST_SUB_BITS) + (v >> e);
+}
+
+/* the largest value in a bucket */
+static unsigned long histTop(int b)
+{
+    int e;
+    if (b < (2 << HIST_SUB_BITS)) return b;
+    e = (b >> HIST_SUB_BITS) - 1;
+    return (((unsigned long) (b - (e << HIST_SUB_BITS)) + 1) << e) - 1;
+}
+
+/* add a value to a histogram */
+void histAdd(Histogram *hist, unsigned long v)
+{
+    hist->counts[histBucket(v)]++;
+    hist->n++;
+    if (v > hist->max) hist->max = v;
+}
+
+/* the value under which a fraction of the histogram's values are */
+static unsigned long histPercentile(Histogram *hist, double p)
+{
+    unsigned long want = hist->n * p, seen = 0;
+    int b;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += hist->counts[b];
+        if (seen > want) break;
+    }
+    return (b < HIST_BUCKETS && histTop(b) < hist->max) ? histTop(b) : hist->max;
+}
+
+/* allocate a histogram to be reported along with the phases */
+Histogram *newStatHistogram(const char *name)
+{
+    Histogram *ret;
+    SF(ret, calloc, NULL, (1, sizeof(Histogram)));
+    SF(ret->name, strdup, NULL, (name));
+    if (!others.buf) INIT_BUFFER(others);
+    WRITE_ONE_BUFFER(others, ret);
+    return ret;
+}
+
+static void histReport(FILE *to, Histogram *hist)
+{
+    if (!hist->n) return;
+    fprintf(to, "%-24s %10lu %12.1f %12.1f %12.1f\n", hist->name, hist->n,
+            histPercentile(hist, 0.5) / 1000.0, histPercentile(hist, 0.99) / 1000.0,
+            hist->max / 1000.0);
+}
+
+/* write every histogram */
+void statsReport(FILE *to)
+{
+    size_t i;
+    fprintf(to, "%-24s %10s %12s %12s %12s\n", "phase (us)", "count", "p50", "p99", "max");
+    for (i = 0; i < STAT_PHASES; i++) histReport(to, statPhases + i);
+    for (i = 0; i < others.bufused; i++) histReport(to, others.buf[i]);
+    fflush(to);
+}
+
+static void statsSignal(int sig)
+{
+    if (sig == SIGUSR1)
+        statsDump = 1;
+    else
+        statsQuit = 1;
+}
+
+static void statsExit(void)
+{
+    statsReport(stderr);
+}
+
+static void statsSignals(sigset_t *set)
+{
+    sigemptyset(set);
+    sigaddset(set, SIGUSR1);
+    sigaddset(set, SIGINT);
+    sigaddset(set, SIGTERM);
+}
+
+/* catch the signals, and report at exit */
+void statsInit(void)
+{
+    struct sigaction sa;
+    sigset_t set;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = statsSignal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    statsSignals(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+    atexit(statsExit);
+}
+
+/* take the signals in this thread */
+void statsListen(void)
+{
+    sigset_t set;
+    statsSignals(&set);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+}
+
+/* report if asked to, or exit if asked to */
+void statsPoll(void)
+{
+    if (statsQuit) exit(0);
+    if (statsDump) {
+        statsDump = 0;
+        statsReport(stderr);
+    }
+}
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2011 Gregor Richards
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ * OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF OR IN
+ * CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+/* with REZZO_STATS (make STATS=1), the phases of each tick and the agents'
+ * response times are timed into histograms, which are written to stderr on
+ * SIGUSR1 and at exit. Without it, all of this compiles to nothing */
+#ifdef REZZO_STATS
+
+#include <signal.h>
+#include <stdio.h>
+
+/* histograms have 16 buckets per power of two (so within about 6%), for
+ * values in nanoseconds */
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS 1024
+
+typedef struct _Histogram Histogram;
+
+struct _Histogram {
+    const char *name;
+    unsigned long n, max;
+    unsigned long counts[HIST_BUCKETS];
+};
+
+enum StatPhases {
+    STAT_UPDATE, /* updateWorld */
+    STAT_LOSSES, /* agentProcessLosses */
+    STAT_VIEWPORT, /* agentServerMessages, mostly building viewports */
+    STAT_SELECT, /* waiting in select */
+    STAT_WRITE, /* writing to agents */
+    STAT_LOCK, /* waiting for the UI to let go of the lock */
+    STAT_PHASES
+};
+
+extern Histogram statPhases[STAT_PHASES];
+extern volatile sig_atomic_t statsDump, statsQuit;
+
+/* the monotonic time in nanoseconds */
+unsigned long statNow(void);
+
+/* add a value to a histogram */
+void histAdd(Histogram *hist, unsigned long v);
+
+/* allocate a histogram to be reported along with the phases */
+Histogram *newStatHistogram(const char *name);
+
+/* catch the signals, and report at exit. They're blocked in this thread
+ * (and any it creates) until statsListen */
+void statsInit(void);
+
+/* take the signals in this thread */
+void statsListen(void);
+
+/* report if asked to by a signal, or exit if asked to */
+void statsPoll(void);
+
+/* write every histogram */
+void statsReport(FILE *to);
+
+#define STAT_DECL(t) unsigned long t;
+#define STAT_START(t) ((t) = statNow())
+#define STAT_END(t, phase) histAdd(statPhases + (phase), statNow() - (t))
+
+#else
+
+#define STAT_DECL(t)
+#define STAT_START(t)
+#define STAT_END(t, phase)
+#define statsInit()
+#define statsListen()
+#define statsPoll()
+
+#endif
+
+#endif
@@ -27,6 +27,10 @@ extern unsigned long frame;
 
 void drawWorld(AgentList *agents, void *bufvp, int z);
 
+/* only the headless UI can draw a frame and write it out separately */
+void renderWorld(AgentList *agents, void *bufvp, int z);
+void writeFrame(void *bufvp, int z);
+
 void *uiInit(int argc, char **argv, AgentList *agents, int w, int h, int z);
 
 void uiRun(AgentList *agents, void *bufvp, int z, pthread_mutex_t *lock);